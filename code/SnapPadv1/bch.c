@@ -0,0 +1,223 @@
+/*
+ * bch.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: phooky
+ */
+
+#include "bch.h"
+
+/**
+ * The code is the BCH code with designed distance 9 over GF(2^13) (primitive
+ * polynomial x^13+x^4+x^3+x+1), shortened to 4096 data bits. Its generator is
+ * the product of the minimal polynomials of a^1, a^3, a^5 and a^7:
+ *   g(x) = 0x14523043ab86ab (degree 52)
+ * Data bits are taken most significant bit first, so byte 0 bit 7 is the
+ * highest-degree data coefficient; the remainder follows the data.
+ */
+#define BCH_M 13
+#define BCH_POLY 0x201B
+#define BCH_N ((1 << BCH_M) - 1)
+#define BCH_PARITY_BITS 52
+#define BCH_DATA_BITS 4096
+
+/**
+ * Encoder table: for every byte value v, the remainder of x^52 * v(x) mod g(x),
+ * left-aligned in 56 bits. Feeding a byte is then a shift of the remainder by
+ * one byte and one row XOR.
+ */
+const uint8_t bch_table[256][BCH_ECC_BYTES] = {
+	{0x00,0x00,0x00,0x00,0x00,0x00,0x00}, {0x45,0x23,0x04,0x3a,0xb8,0x6a,0xb0}, {0x8a,0x46,0x08,0x75,0x70,0xd5,0x60}, {0xcf,0x65,0x0c,0x4f,0xc8,0xbf,0xd0},
+	{0x51,0xaf,0x14,0xd0,0x59,0xc0,0x70}, {0x14,0x8c,0x10,0xea,0xe1,0xaa,0xc0}, {0xdb,0xe9,0x1c,0xa5,0x29,0x15,0x10}, {0x9e,0xca,0x18,0x9f,0x91,0x7f,0xa0},
+	{0xa3,0x5e,0x29,0xa0,0xb3,0x80,0xe0}, {0xe6,0x7d,0x2d,0x9a,0x0b,0xea,0x50}, {0x29,0x18,0x21,0xd5,0xc3,0x55,0x80}, {0x6c,0x3b,0x25,0xef,0x7b,0x3f,0x30},
+	{0xf2,0xf1,0x3d,0x70,0xea,0x40,0x90}, {0xb7,0xd2,0x39,0x4a,0x52,0x2a,0x20}, {0x78,0xb7,0x35,0x05,0x9a,0x95,0xf0}, {0x3d,0x94,0x31,0x3f,0x22,0xff,0x40},
+	{0x03,0x9f,0x57,0x7b,0xdf,0x6b,0x70}, {0x46,0xbc,0x53,0x41,0x67,0x01,0xc0}, {0x89,0xd9,0x5f,0x0e,0xaf,0xbe,0x10}, {0xcc,0xfa,0x5b,0x34,0x17,0xd4,0xa0},
+	{0x52,0x30,0x43,0xab,0x86,0xab,0x00}, {0x17,0x13,0x47,0x91,0x3e,0xc1,0xb0}, {0xd8,0x76,0x4b,0xde,0xf6,0x7e,0x60}, {0x9d,0x55,0x4f,0xe4,0x4e,0x14,0xd0},
+	{0xa0,0xc1,0x7e,0xdb,0x6c,0xeb,0x90}, {0xe5,0xe2,0x7a,0xe1,0xd4,0x81,0x20}, {0x2a,0x87,0x76,0xae,0x1c,0x3e,0xf0}, {0x6f,0xa4,0x72,0x94,0xa4,0x54,0x40},
+	{0xf1,0x6e,0x6a,0x0b,0x35,0x2b,0xe0}, {0xb4,0x4d,0x6e,0x31,0x8d,0x41,0x50}, {0x7b,0x28,0x62,0x7e,0x45,0xfe,0x80}, {0x3e,0x0b,0x66,0x44,0xfd,0x94,0x30},
+	{0x07,0x3e,0xae,0xf7,0xbe,0xd6,0xe0}, {0x42,0x1d,0xaa,0xcd,0x06,0xbc,0x50}, {0x8d,0x78,0xa6,0x82,0xce,0x03,0x80}, {0xc8,0x5b,0xa2,0xb8,0x76,0x69,0x30},
+	{0x56,0x91,0xba,0x27,0xe7,0x16,0x90}, {0x13,0xb2,0xbe,0x1d,0x5f,0x7c,0x20}, {0xdc,0xd7,0xb2,0x52,0x97,0xc3,0xf0}, {0x99,0xf4,0xb6,0x68,0x2f,0xa9,0x40},
+	{0xa4,0x60,0x87,0x57,0x0d,0x56,0x00}, {0xe1,0x43,0x83,0x6d,0xb5,0x3c,0xb0}, {0x2e,0x26,0x8f,0x22,0x7d,0x83,0x60}, {0x6b,0x05,0x8b,0x18,0xc5,0xe9,0xd0},
+	{0xf5,0xcf,0x93,0x87,0x54,0x96,0x70}, {0xb0,0xec,0x97,0xbd,0xec,0xfc,0xc0}, {0x7f,0x89,0x9b,0xf2,0x24,0x43,0x10}, {0x3a,0xaa,0x9f,0xc8,0x9c,0x29,0xa0},
+	{0x04,0xa1,0xf9,0x8c,0x61,0xbd,0x90}, {0x41,0x82,0xfd,0xb6,0xd9,0xd7,0x20}, {0x8e,0xe7,0xf1,0xf9,0x11,0x68,0xf0}, {0xcb,0xc4,0xf5,0xc3,0xa9,0x02,0x40},
+	{0x55,0x0e,0xed,0x5c,0x38,0x7d,0xe0}, {0x10,0x2d,0xe9,0x66,0x80,0x17,0x50}, {0xdf,0x48,0xe5,0x29,0x48,0xa8,0x80}, {0x9a,0x6b,0xe1,0x13,0xf0,0xc2,0x30},
+	{0xa7,0xff,0xd0,0x2c,0xd2,0x3d,0x70}, {0xe2,0xdc,0xd4,0x16,0x6a,0x57,0xc0}, {0x2d,0xb9,0xd8,0x59,0xa2,0xe8,0x10}, {0x68,0x9a,0xdc,0x63,0x1a,0x82,0xa0},
+	{0xf6,0x50,0xc4,0xfc,0x8b,0xfd,0x00}, {0xb3,0x73,0xc0,0xc6,0x33,0x97,0xb0}, {0x7c,0x16,0xcc,0x89,0xfb,0x28,0x60}, {0x39,0x35,0xc8,0xb3,0x43,0x42,0xd0},
+	{0x0e,0x7d,0x5d,0xef,0x7d,0xad,0xc0}, {0x4b,0x5e,0x59,0xd5,0xc5,0xc7,0x70}, {0x84,0x3b,0x55,0x9a,0x0d,0x78,0xa0}, {0xc1,0x18,0x51,0xa0,0xb5,0x12,0x10},
+	{0x5f,0xd2,0x49,0x3f,0x24,0x6d,0xb0}, {0x1a,0xf1,0x4d,0x05,0x9c,0x07,0x00}, {0xd5,0x94,0x41,0x4a,0x54,0xb8,0xd0}, {0x90,0xb7,0x45,0x70,0xec,0xd2,0x60},
+	{0xad,0x23,0x74,0x4f,0xce,0x2d,0x20}, {0xe8,0x00,0x70,0x75,0x76,0x47,0x90}, {0x27,0x65,0x7c,0x3a,0xbe,0xf8,0x40}, {0x62,0x46,0x78,0x00,0x06,0x92,0xf0},
+	{0xfc,0x8c,0x60,0x9f,0x97,0xed,0x50}, {0xb9,0xaf,0x64,0xa5,0x2f,0x87,0xe0}, {0x76,0xca,0x68,0xea,0xe7,0x38,0x30}, {0x33,0xe9,0x6c,0xd0,0x5f,0x52,0x80},
+	{0x0d,0xe2,0x0a,0x94,0xa2,0xc6,0xb0}, {0x48,0xc1,0x0e,0xae,0x1a,0xac,0x00}, {0x87,0xa4,0x02,0xe1,0xd2,0x13,0xd0}, {0xc2,0x87,0x06,0xdb,0x6a,0x79,0x60},
+	{0x5c,0x4d,0x1e,0x44,0xfb,0x06,0xc0}, {0x19,0x6e,0x1a,0x7e,0x43,0x6c,0x70}, {0xd6,0x0b,0x16,0x31,0x8b,0xd3,0xa0}, {0x93,0x28,0x12,0x0b,0x33,0xb9,0x10},
+	{0xae,0xbc,0x23,0x34,0x11,0x46,0x50}, {0xeb,0x9f,0x27,0x0e,0xa9,0x2c,0xe0}, {0x24,0xfa,0x2b,0x41,0x61,0x93,0x30}, {0x61,0xd9,0x2f,0x7b,0xd9,0xf9,0x80},
+	{0xff,0x13,0x37,0xe4,0x48,0x86,0x20}, {0xba,0x30,0x33,0xde,0xf0,0xec,0x90}, {0x75,0x55,0x3f,0x91,0x38,0x53,0x40}, {0x30,0x76,0x3b,0xab,0x80,0x39,0xf0},
+	{0x09,0x43,0xf3,0x18,0xc3,0x7b,0x20}, {0x4c,0x60,0xf7,0x22,0x7b,0x11,0x90}, {0x83,0x05,0xfb,0x6d,0xb3,0xae,0x40}, {0xc6,0x26,0xff,0x57,0x0b,0xc4,0xf0},
+	{0x58,0xec,0xe7,0xc8,0x9a,0xbb,0x50}, {0x1d,0xcf,0xe3,0xf2,0x22,0xd1,0xe0}, {0xd2,0xaa,0xef,0xbd,0xea,0x6e,0x30}, {0x97,0x89,0xeb,0x87,0x52,0x04,0x80},
+	{0xaa,0x1d,0xda,0xb8,0x70,0xfb,0xc0}, {0xef,0x3e,0xde,0x82,0xc8,0x91,0x70}, {0x20,0x5b,0xd2,0xcd,0x00,0x2e,0xa0}, {0x65,0x78,0xd6,0xf7,0xb8,0x44,0x10},
+	{0xfb,0xb2,0xce,0x68,0x29,0x3b,0xb0}, {0xbe,0x91,0xca,0x52,0x91,0x51,0x00}, {0x71,0xf4,0xc6,0x1d,0x59,0xee,0xd0}, {0x34,0xd7,0xc2,0x27,0xe1,0x84,0x60},
+	{0x0a,0xdc,0xa4,0x63,0x1c,0x10,0x50}, {0x4f,0xff,0xa0,0x59,0xa4,0x7a,0xe0}, {0x80,0x9a,0xac,0x16,0x6c,0xc5,0x30}, {0xc5,0xb9,0xa8,0x2c,0xd4,0xaf,0x80},
+	{0x5b,0x73,0xb0,0xb3,0x45,0xd0,0x20}, {0x1e,0x50,0xb4,0x89,0xfd,0xba,0x90}, {0xd1,0x35,0xb8,0xc6,0x35,0x05,0x40}, {0x94,0x16,0xbc,0xfc,0x8d,0x6f,0xf0},
+	{0xa9,0x82,0x8d,0xc3,0xaf,0x90,0xb0}, {0xec,0xa1,0x89,0xf9,0x17,0xfa,0x00}, {0x23,0xc4,0x85,0xb6,0xdf,0x45,0xd0}, {0x66,0xe7,0x81,0x8c,0x67,0x2f,0x60},
+	{0xf8,0x2d,0x99,0x13,0xf6,0x50,0xc0}, {0xbd,0x0e,0x9d,0x29,0x4e,0x3a,0x70}, {0x72,0x6b,0x91,0x66,0x86,0x85,0xa0}, {0x37,0x48,0x95,0x5c,0x3e,0xef,0x10},
+	{0x1c,0xfa,0xbb,0xde,0xfb,0x5b,0x80}, {0x59,0xd9,0xbf,0xe4,0x43,0x31,0x30}, {0x96,0xbc,0xb3,0xab,0x8b,0x8e,0xe0}, {0xd3,0x9f,0xb7,0x91,0x33,0xe4,0x50},
+	{0x4d,0x55,0xaf,0x0e,0xa2,0x9b,0xf0}, {0x08,0x76,0xab,0x34,0x1a,0xf1,0x40}, {0xc7,0x13,0xa7,0x7b,0xd2,0x4e,0x90}, {0x82,0x30,0xa3,0x41,0x6a,0x24,0x20},
+	{0xbf,0xa4,0x92,0x7e,0x48,0xdb,0x60}, {0xfa,0x87,0x96,0x44,0xf0,0xb1,0xd0}, {0x35,0xe2,0x9a,0x0b,0x38,0x0e,0x00}, {0x70,0xc1,0x9e,0x31,0x80,0x64,0xb0},
+	{0xee,0x0b,0x86,0xae,0x11,0x1b,0x10}, {0xab,0x28,0x82,0x94,0xa9,0x71,0xa0}, {0x64,0x4d,0x8e,0xdb,0x61,0xce,0x70}, {0x21,0x6e,0x8a,0xe1,0xd9,0xa4,0xc0},
+	{0x1f,0x65,0xec,0xa5,0x24,0x30,0xf0}, {0x5a,0x46,0xe8,0x9f,0x9c,0x5a,0x40}, {0x95,0x23,0xe4,0xd0,0x54,0xe5,0x90}, {0xd0,0x00,0xe0,0xea,0xec,0x8f,0x20},
+	{0x4e,0xca,0xf8,0x75,0x7d,0xf0,0x80}, {0x0b,0xe9,0xfc,0x4f,0xc5,0x9a,0x30}, {0xc4,0x8c,0xf0,0x00,0x0d,0x25,0xe0}, {0x81,0xaf,0xf4,0x3a,0xb5,0x4f,0x50},
+	{0xbc,0x3b,0xc5,0x05,0x97,0xb0,0x10}, {0xf9,0x18,0xc1,0x3f,0x2f,0xda,0xa0}, {0x36,0x7d,0xcd,0x70,0xe7,0x65,0x70}, {0x73,0x5e,0xc9,0x4a,0x5f,0x0f,0xc0},
+	{0xed,0x94,0xd1,0xd5,0xce,0x70,0x60}, {0xa8,0xb7,0xd5,0xef,0x76,0x1a,0xd0}, {0x67,0xd2,0xd9,0xa0,0xbe,0xa5,0x00}, {0x22,0xf1,0xdd,0x9a,0x06,0xcf,0xb0},
+	{0x1b,0xc4,0x15,0x29,0x45,0x8d,0x60}, {0x5e,0xe7,0x11,0x13,0xfd,0xe7,0xd0}, {0x91,0x82,0x1d,0x5c,0x35,0x58,0x00}, {0xd4,0xa1,0x19,0x66,0x8d,0x32,0xb0},
+	{0x4a,0x6b,0x01,0xf9,0x1c,0x4d,0x10}, {0x0f,0x48,0x05,0xc3,0xa4,0x27,0xa0}, {0xc0,0x2d,0x09,0x8c,0x6c,0x98,0x70}, {0x85,0x0e,0x0d,0xb6,0xd4,0xf2,0xc0},
+	{0xb8,0x9a,0x3c,0x89,0xf6,0x0d,0x80}, {0xfd,0xb9,0x38,0xb3,0x4e,0x67,0x30}, {0x32,0xdc,0x34,0xfc,0x86,0xd8,0xe0}, {0x77,0xff,0x30,0xc6,0x3e,0xb2,0x50},
+	{0xe9,0x35,0x28,0x59,0xaf,0xcd,0xf0}, {0xac,0x16,0x2c,0x63,0x17,0xa7,0x40}, {0x63,0x73,0x20,0x2c,0xdf,0x18,0x90}, {0x26,0x50,0x24,0x16,0x67,0x72,0x20},
+	{0x18,0x5b,0x42,0x52,0x9a,0xe6,0x10}, {0x5d,0x78,0x46,0x68,0x22,0x8c,0xa0}, {0x92,0x1d,0x4a,0x27,0xea,0x33,0x70}, {0xd7,0x3e,0x4e,0x1d,0x52,0x59,0xc0},
+	{0x49,0xf4,0x56,0x82,0xc3,0x26,0x60}, {0x0c,0xd7,0x52,0xb8,0x7b,0x4c,0xd0}, {0xc3,0xb2,0x5e,0xf7,0xb3,0xf3,0x00}, {0x86,0x91,0x5a,0xcd,0x0b,0x99,0xb0},
+	{0xbb,0x05,0x6b,0xf2,0x29,0x66,0xf0}, {0xfe,0x26,0x6f,0xc8,0x91,0x0c,0x40}, {0x31,0x43,0x63,0x87,0x59,0xb3,0x90}, {0x74,0x60,0x67,0xbd,0xe1,0xd9,0x20},
+	{0xea,0xaa,0x7f,0x22,0x70,0xa6,0x80}, {0xaf,0x89,0x7b,0x18,0xc8,0xcc,0x30}, {0x60,0xec,0x77,0x57,0x00,0x73,0xe0}, {0x25,0xcf,0x73,0x6d,0xb8,0x19,0x50},
+	{0x12,0x87,0xe6,0x31,0x86,0xf6,0x40}, {0x57,0xa4,0xe2,0x0b,0x3e,0x9c,0xf0}, {0x98,0xc1,0xee,0x44,0xf6,0x23,0x20}, {0xdd,0xe2,0xea,0x7e,0x4e,0x49,0x90},
+	{0x43,0x28,0xf2,0xe1,0xdf,0x36,0x30}, {0x06,0x0b,0xf6,0xdb,0x67,0x5c,0x80}, {0xc9,0x6e,0xfa,0x94,0xaf,0xe3,0x50}, {0x8c,0x4d,0xfe,0xae,0x17,0x89,0xe0},
+	{0xb1,0xd9,0xcf,0x91,0x35,0x76,0xa0}, {0xf4,0xfa,0xcb,0xab,0x8d,0x1c,0x10}, {0x3b,0x9f,0xc7,0xe4,0x45,0xa3,0xc0}, {0x7e,0xbc,0xc3,0xde,0xfd,0xc9,0x70},
+	{0xe0,0x76,0xdb,0x41,0x6c,0xb6,0xd0}, {0xa5,0x55,0xdf,0x7b,0xd4,0xdc,0x60}, {0x6a,0x30,0xd3,0x34,0x1c,0x63,0xb0}, {0x2f,0x13,0xd7,0x0e,0xa4,0x09,0x00},
+	{0x11,0x18,0xb1,0x4a,0x59,0x9d,0x30}, {0x54,0x3b,0xb5,0x70,0xe1,0xf7,0x80}, {0x9b,0x5e,0xb9,0x3f,0x29,0x48,0x50}, {0xde,0x7d,0xbd,0x05,0x91,0x22,0xe0},
+	{0x40,0xb7,0xa5,0x9a,0x00,0x5d,0x40}, {0x05,0x94,0xa1,0xa0,0xb8,0x37,0xf0}, {0xca,0xf1,0xad,0xef,0x70,0x88,0x20}, {0x8f,0xd2,0xa9,0xd5,0xc8,0xe2,0x90},
+	{0xb2,0x46,0x98,0xea,0xea,0x1d,0xd0}, {0xf7,0x65,0x9c,0xd0,0x52,0x77,0x60}, {0x38,0x00,0x90,0x9f,0x9a,0xc8,0xb0}, {0x7d,0x23,0x94,0xa5,0x22,0xa2,0x00},
+	{0xe3,0xe9,0x8c,0x3a,0xb3,0xdd,0xa0}, {0xa6,0xca,0x88,0x00,0x0b,0xb7,0x10}, {0x69,0xaf,0x84,0x4f,0xc3,0x08,0xc0}, {0x2c,0x8c,0x80,0x75,0x7b,0x62,0x70},
+	{0x15,0xb9,0x48,0xc6,0x38,0x20,0xa0}, {0x50,0x9a,0x4c,0xfc,0x80,0x4a,0x10}, {0x9f,0xff,0x40,0xb3,0x48,0xf5,0xc0}, {0xda,0xdc,0x44,0x89,0xf0,0x9f,0x70},
+	{0x44,0x16,0x5c,0x16,0x61,0xe0,0xd0}, {0x01,0x35,0x58,0x2c,0xd9,0x8a,0x60}, {0xce,0x50,0x54,0x63,0x11,0x35,0xb0}, {0x8b,0x73,0x50,0x59,0xa9,0x5f,0x00},
+	{0xb6,0xe7,0x61,0x66,0x8b,0xa0,0x40}, {0xf3,0xc4,0x65,0x5c,0x33,0xca,0xf0}, {0x3c,0xa1,0x69,0x13,0xfb,0x75,0x20}, {0x79,0x82,0x6d,0x29,0x43,0x1f,0x90},
+	{0xe7,0x48,0x75,0xb6,0xd2,0x60,0x30}, {0xa2,0x6b,0x71,0x8c,0x6a,0x0a,0x80}, {0x6d,0x0e,0x7d,0xc3,0xa2,0xb5,0x50}, {0x28,0x2d,0x79,0xf9,0x1a,0xdf,0xe0},
+	{0x16,0x26,0x1f,0xbd,0xe7,0x4b,0xd0}, {0x53,0x05,0x1b,0x87,0x5f,0x21,0x60}, {0x9c,0x60,0x17,0xc8,0x97,0x9e,0xb0}, {0xd9,0x43,0x13,0xf2,0x2f,0xf4,0x00},
+	{0x47,0x89,0x0b,0x6d,0xbe,0x8b,0xa0}, {0x02,0xaa,0x0f,0x57,0x06,0xe1,0x10}, {0xcd,0xcf,0x03,0x18,0xce,0x5e,0xc0}, {0x88,0xec,0x07,0x22,0x76,0x34,0x70},
+	{0xb5,0x78,0x36,0x1d,0x54,0xcb,0x30}, {0xf0,0x5b,0x32,0x27,0xec,0xa1,0x80}, {0x3f,0x3e,0x3e,0x68,0x24,0x1e,0x50}, {0x7a,0x1d,0x3a,0x52,0x9c,0x74,0xe0},
+	{0xe4,0xd7,0x22,0xcd,0x0d,0x0b,0x40}, {0xa1,0xf4,0x26,0xf7,0xb5,0x61,0xf0}, {0x6e,0x91,0x2a,0xb8,0x7d,0xde,0x20}, {0x2b,0xb2,0x2e,0x82,0xc5,0xb4,0x90}
+};
+
+/** Multiply two elements of GF(2^13). Only used on the correction path. */
+static uint16_t gf_mul(uint16_t a, uint16_t b) {
+	uint16_t r = 0;
+	while (b) {
+		if (b & 1) r ^= a;
+		b >>= 1;
+		a <<= 1;
+		if (a & (1 << BCH_M)) a ^= BCH_POLY;
+	}
+	return r;
+}
+
+/** Raise an element of GF(2^13) to a power. */
+static uint16_t gf_pow(uint16_t a, uint16_t e) {
+	uint16_t r = 1;
+	while (e) {
+		if (e & 1) r = gf_mul(r,a);
+		a = gf_mul(a,a);
+		e >>= 1;
+	}
+	return r;
+}
+
+/** Invert a nonzero element of GF(2^13) (a^(2^13-2)). */
+static uint16_t gf_inv(uint16_t a) {
+	return gf_pow(a,BCH_N - 1);
+}
+
+void bch_begin(BchState* state) {
+	uint8_t i;
+	for (i = 0; i < BCH_ECC_BYTES; i++) state->r[i] = 0;
+}
+
+void bch_generate(const uint8_t* buffer, uint8_t* code) {
+	uint16_t idx;
+	uint8_t i;
+	BchState state;
+	bch_begin(&state);
+	for (idx = 0; idx < 512; idx++) {
+		bch_update(&state,buffer[idx]);
+	}
+	for (i = 0; i < BCH_ECC_BYTES; i++) code[i] = state.r[i];
+}
+
+int8_t bch_verify(uint8_t* buffer, const uint8_t* code) {
+	uint8_t computed[BCH_ECC_BYTES];
+	bch_generate(buffer,computed);
+	return bch_correct(buffer,computed,code);
+}
+
+int8_t bch_correct(uint8_t* buffer, const uint8_t* computed, const uint8_t* code) {
+	uint8_t diff[BCH_ECC_BYTES];
+	uint8_t i, j;
+	bool clean = true;
+	for (i = 0; i < BCH_ECC_BYTES; i++) {
+		diff[i] = computed[i] ^ code[i];
+		if (diff[i]) clean = false;
+	}
+	if (clean) return 0; // No error
+
+	// The data part of the received word is a codeword plus the recomputed
+	// remainder, so the syndromes of the whole word are those of the
+	// 52-bit difference between the two remainders.
+	uint16_t s[2*BCH_T+1];
+	for (j = 1; j <= 2*BCH_T; j += 2) {
+		uint16_t aj = gf_pow(2,j);
+		uint16_t sj = 0;
+		int8_t k;
+		for (k = BCH_PARITY_BITS-1; k >= 0; k--) {
+			uint8_t bit = k + (8*BCH_ECC_BYTES - BCH_PARITY_BITS);
+			sj = gf_mul(sj,aj);
+			if (diff[BCH_ECC_BYTES-1 - (bit >> 3)] & (1 << (bit & 7))) sj ^= 1;
+		}
+		s[j] = sj;
+	}
+	// for a binary code S(2j) = S(j)^2
+	for (j = 2; j <= 2*BCH_T; j += 2) s[j] = gf_mul(s[j/2],s[j/2]);
+
+	// Berlekamp-Massey: find the error locator polynomial lambda
+	uint16_t lambda[2*BCH_T+1], prev[2*BCH_T+1], tmp[2*BCH_T+1];
+	uint8_t l = 0, m = 1;
+	uint16_t b = 1;
+	for (i = 0; i <= 2*BCH_T; i++) { lambda[i] = prev[i] = 0; }
+	lambda[0] = prev[0] = 1;
+	for (i = 0; i < 2*BCH_T; i++) {
+		uint16_t d = s[i+1];
+		uint16_t coef;
+		for (j = 1; j <= l; j++) d ^= gf_mul(lambda[j],s[i+1-j]);
+		if (d == 0) { m++; continue; }
+		coef = gf_mul(d,gf_inv(b));
+		for (j = 0; j <= 2*BCH_T; j++) tmp[j] = lambda[j];
+		for (j = 0; j + m <= 2*BCH_T; j++) lambda[j+m] ^= gf_mul(coef,prev[j]);
+		if (2*l <= i) {
+			l = i + 1 - l;
+			for (j = 0; j <= 2*BCH_T; j++) prev[j] = tmp[j];
+			b = d;
+			m = 1;
+		} else {
+			m++;
+		}
+	}
+	if (l > BCH_T) return -1;
+
+	// Chien search over every bit position of the shortened code. At
+	// position d each term holds lambda[j] * a^(-j*d).
+	uint16_t term[BCH_T+1], step[BCH_T+1];
+	uint8_t found = 0, fixed = 0;
+	uint16_t d;
+	for (j = 1; j <= l; j++) {
+		term[j] = lambda[j];
+		step[j] = gf_inv(gf_pow(2,j));
+	}
+	for (d = 0; d < BCH_DATA_BITS + BCH_PARITY_BITS; d++) {
+		uint16_t sum = 1;
+		for (j = 1; j <= l; j++) sum ^= term[j];
+		if (sum == 0) {
+			if (d >= BCH_PARITY_BITS) {
+				uint16_t k = (BCH_DATA_BITS-1) - (d - BCH_PARITY_BITS);
+				buffer[k >> 3] ^= 0x80 >> (k & 7);
+				fixed++;
+			} // errors in the stored code itself need no repair
+			found++;
+		}
+		for (j = 1; j <= l; j++) term[j] = gf_mul(term[j],step[j]);
+	}
+	if (found != l) return -1;
+	return fixed;
+}
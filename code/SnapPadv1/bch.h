@@ -0,0 +1,83 @@
+/*
+ * bch.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: phooky
+ */
+
+#ifndef BCH_H_
+#define BCH_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * Binary BCH code over GF(2^13), shortened to protect one 512B paragraph.
+ * It corrects up to BCH_T bit errors anywhere in the paragraph or in the
+ * code itself. The 52 parity bits are stored big-endian and left-aligned
+ * in BCH_ECC_BYTES bytes of the paragraph's spare area.
+ */
+#define BCH_T 4
+#define BCH_ECC_BYTES 7
+
+/** Remainder of x^52 * v(x) mod g(x) for every byte v; see bch.c. */
+extern const uint8_t bch_table[256][BCH_ECC_BYTES];
+
+/**
+ * Running state of a BCH code that is built up one byte at a time, so that
+ * the code can be computed while the data is clocked on or off the NAND bus.
+ */
+typedef struct {
+	uint8_t r[BCH_ECC_BYTES];
+} BchState;
+
+/**
+ * Reset a running BCH code before the first byte of a paragraph.
+ * @param state the running code to reset
+ */
+void bch_begin(BchState* state);
+
+/**
+ * Add the next byte of the paragraph to a running BCH code.
+ * @param state the running code
+ * @param c the byte value
+ */
+static inline void bch_update(BchState* state, uint8_t c) {
+	const uint8_t* t = bch_table[state->r[0] ^ c];
+	state->r[0] = state->r[1] ^ t[0];
+	state->r[1] = state->r[2] ^ t[1];
+	state->r[2] = state->r[3] ^ t[2];
+	state->r[3] = state->r[4] ^ t[3];
+	state->r[4] = state->r[5] ^ t[4];
+	state->r[5] = state->r[6] ^ t[5];
+	state->r[6] = t[6];
+}
+
+/**
+ * Generate the BCH code for a 512 byte buffer.
+ * @param buffer the 512B buffer to generate a code for
+ * @param code the BCH_ECC_BYTES bytes to receive the code
+ */
+void bch_generate(const uint8_t* buffer, uint8_t* code);
+
+/**
+ * Verify and correct a 512 byte buffer whose code has already been computed (for
+ * instance while it was read off the bus). Correctable errors are fixed in the
+ * passed buffer. When the codes match this costs a single comparison.
+ * @param buffer the 512B buffer to correct
+ * @param computed the code computed over the buffer as it stands
+ * @param code the stored code to verify with
+ * @return the number of data bits corrected (0 if there was no error, or the errors
+ * were all in the stored code), or -1 if the buffer has more errors than can be corrected.
+ */
+int8_t bch_correct(uint8_t* buffer, const uint8_t* computed, const uint8_t* code);
+
+/**
+ * Verify and correct a 512 byte buffer with the given code.
+ * @param buffer the 512B buffer to verify
+ * @param code the stored code to verify with
+ * @return the number of data bits corrected, or -1 if the buffer cannot be fixed.
+ */
+int8_t bch_verify(uint8_t* buffer, const uint8_t* code);
+
+#endif /* BCH_H_ */
@@ -0,0 +1,125 @@
+#include "bch.h"
+#include "ecc.h"
+#include <stdio.h>
+#include <time.h>
+#include <stdlib.h>
+
+
+uint8_t buf1[512];
+uint8_t buf2[512];
+uint8_t code[BCH_ECC_BYTES];
+
+void prep_buffers() {
+  for (int i = 0; i < 512; i++) {
+    buf1[i] = buf2[i] = rand();
+  }
+}
+
+bool check_buffers() {
+  for (int i = 0; i < 512; i++) {
+    if (buf1[i] != buf2[i]) return false;
+  }
+  return true;
+}
+
+// Flip n distinct bits across the 512 data bytes and the stored code; returns the
+// number flipped in the data.
+int flip_bits(int n) {
+  int data = 0;
+  int flipped[8];
+  for (int e = 0; e < n; e++) {
+    int pos;
+    bool dup;
+    do {
+      pos = rand() % (512*8 + 52);
+      dup = false;
+      for (int p = 0; p < e; p++) if (flipped[p] == pos) dup = true;
+    } while (dup);
+    flipped[e] = pos;
+    if (pos < 512*8) {
+      buf2[pos/8] ^= 1 << (pos%8);
+      data++;
+    } else {
+      // parity bits occupy the top 52 bits of the 7 code bytes
+      pos -= 512*8;
+      code[pos/8] ^= 0x80 >> (pos%8);
+    }
+  }
+  return data;
+}
+
+// Bitwise long division by the generator; checks the encoder table.
+bool run_table_test() {
+  const uint64_t g = 0x14523043ab86abULL;
+  for (int v = 0; v < 256; v++) {
+    uint64_t r = (uint64_t)v << 52;
+    for (int b = 59; b >= 52; b--) {
+      if (r & ((uint64_t)1 << b)) r ^= g << (b - 52);
+    }
+    uint64_t t = 0;
+    for (int i = 0; i < BCH_ECC_BYTES; i++) t = (t << 8) | bch_table[v][i];
+    if (t != (r << 4)) return false;
+  }
+  return true;
+}
+
+// Returns true if n errors were corrected exactly, counting those in the data.
+bool run_err_test(int n) {
+  prep_buffers();
+  bch_generate(buf1,code);
+  int data = flip_bits(n);
+  int8_t fixed = bch_verify(buf2,code);
+  return fixed == data && check_buffers();
+}
+
+// Returns true if t+1 errors were reported rather than silently miscorrected.
+bool run_overflow_test() {
+  prep_buffers();
+  bch_generate(buf1,code);
+  flip_bits(BCH_T+1);
+  return bch_verify(buf2,code) < 0;
+}
+
+#define TC 2000
+#define BENCH_PARAS 200000
+
+volatile uint32_t bench_sink;
+
+void run_bench() {
+  prep_buffers();
+  clock_t start = clock();
+  for (int i = 0; i < BENCH_PARAS; i++) {
+    buf1[i & 511] ^= i;
+    bench_sink ^= ecc_generate(buf1);
+  }
+  double secded = (double)(clock() - start) / CLOCKS_PER_SEC;
+  start = clock();
+  for (int i = 0; i < BENCH_PARAS; i++) {
+    buf1[i & 511] ^= i;
+    bch_generate(buf1,code);
+    bench_sink ^= code[0];
+  }
+  double bch = (double)(clock() - start) / CLOCKS_PER_SEC;
+  printf("Clean paragraph cost (%d paragraphs):\n", BENCH_PARAS);
+  printf("  SEC-DED: %8.1f ns/para\n", secded * 1e9 / BENCH_PARAS);
+  printf("  BCH:     %8.1f ns/para\n", bch * 1e9 / BENCH_PARAS);
+}
+
+void main() {
+  srand(time(NULL));
+  printf("BCH test start.\n");
+  printf("Encoder table: %s\n", run_table_test() ? "passed" : "FAILED");
+  for (int n = 0; n <= BCH_T; n++) {
+    int passes = 0;
+    for (int t=0;t<TC;t++) {
+      if (run_err_test(n)) { passes++; }
+    }
+    printf("%d errors: %d/%d corrected.\n",n,passes,TC);
+  }
+  int passes = 0;
+  for (int t=0;t<TC;t++) {
+    if (run_overflow_test()) { passes++; }
+  }
+  printf("%d errors: %d/%d detected.\n",BCH_T+1,passes,TC);
+  run_bench();
+}
@@ -12,11 +12,23 @@
 static uint8_t buffer_A[PARA_SIZE+PARA_SPARE_SIZE];
 static uint8_t buffer_B[PARA_SIZE+PARA_SPARE_SIZE];
 
+static uint8_t buffer_half[2*PARA_SIZE];
+
 static uint8_t* buffer_nand = buffer_A;
 static uint8_t* buffer_rng = buffer_B;
 
 uint8_t* buffers_get_nand() { return buffer_nand; }
 uint8_t* buffers_get_rng() { return buffer_rng; }
+uint8_t* buffers_get_page_half() { return buffer_half; }
+
+static uint8_t* const buffer_ring[BUFFER_RING_LEN] = { buffer_A, buffer_B, buffer_half };
+
+uint8_t* buffers_get_ring(uint8_t slot) { return buffer_ring[slot]; }
+
+void buffers_select_ring(uint8_t slot) {
+	buffer_nand = buffer_ring[slot];
+	buffer_rng = (buffer_nand == buffer_A)?buffer_B:buffer_A;
+}
 
 void buffers_init() {
 	uint16_t idx;
@@ -13,6 +13,31 @@
 uint8_t* buffers_get_nand();
 uint8_t* buffers_get_rng();
 
+/**
+ * Get the buffer for the data of the second half of a page (two paragraphs,
+ * without their spare areas), so that a whole page can be held in RAM while
+ * it is released.
+ */
+uint8_t* buffers_get_page_half();
+
+/** Paragraph buffers in the randomization pipeline (see otp_randomize_boards). */
+#define BUFFER_RING_LEN 3
+
+/**
+ * Get a paragraph buffer of the randomization pipeline. The first two slots are
+ * the nand and rng buffers; the third borrows the page half buffer, which is only
+ * used while pages are released.
+ * @param slot the slot (0 to BUFFER_RING_LEN-1)
+ */
+uint8_t* buffers_get_ring(uint8_t slot);
+
+/**
+ * Make a ring slot the nand buffer, the one paragraphs are loaded into the NAND
+ * from. The rng buffer becomes whichever of the first two slots is left over.
+ * @param slot the slot (0 to BUFFER_RING_LEN-1)
+ */
+void buffers_select_ring(uint8_t slot);
+
 void buffers_init();
 void buffers_swap();
 
@@ -20,7 +20,16 @@
 	minor version number, and V is the (optional) one character long
 	build variant type. */
 #define MAJOR_VERSION 1
-#define MINOR_VERSION 1
+#define MINOR_VERSION 3
+
+/** Define to protect pad paragraphs with the 4-bit BCH code rather than
+	the single-bit SEC-DED code. The choice is recorded in the minor
+	version of the pad header when the pad is initialized, so boards
+	read back their pads correctly whichever way they were built.
+	Building the BCH code as a paragraph is read costs about twice as much
+	as the SEC-DED code (see bch_test), so it is off until that cost has
+	been measured on a board. */
+//#define ECC_BCH
 
 /** The firmware variant is defined based on the values of the
 	DEBUG and FACTORY_TEST flags. */
@@ -32,6 +41,46 @@
 	#define VARIANT ""
 #endif
 
+/** Define to move NAND data with DMA channels 1 and 2, with the RE#/WE#
+	strobes generated by Timer_B0. Leave undefined to strobe the bus
+	from the CPU. */
+#define NAND_DMA
+
+/** Define to use the faster DMA strobe timing on chips that report ONFI
+	timing mode 1 or better. It has not been validated on a board yet; check
+	the 'B' throughput and a full randomize and retrieve with it first.
+	Leave undefined to run every chip at the mode 0 timing. */
+//#define NAND_FAST_TIMING
+
+/** Define to count NAND operations and the time spent waiting on the chip
+	(see NandStats), and the stalls of the twin randomization pipeline
+	(see RandomizeStats). The counters are reported over USB by the 'S' command.
+	They are on by default in debug builds. */
+#if defined(DEBUG)
+	#define NAND_STATS
+#endif
+
+/** Define to release provisioned pages by marking them used in the spare
+	area rather than zeroing them, and to erase each block once provisioning
+	moves past it. Releasing a page then takes one small program instead of
+	one page-wide zero program, but the pad data of the block being
+	provisioned stays on the chip until the block is finished. Retrieved
+	pages are zeroed either way. */
+//#define OTP_DEFERRED_ERASE
+
+/** Define to read each block back once it has been randomized, and check its
+	data against the CRC-32 of what was written. Either way the twins compare
+	the CRCs of the data each of them sent and received, which are built up as
+	the paragraphs go by; the read-back also catches data the chip didn't keep,
+	at the cost of reading every block again. */
+//#define OTP_READBACK_VERIFY
+
+/** Define to have both boards generate random data during randomization, each
+	for half of every page, and swap it over the UART in both directions at
+	once. This takes about half as long as having the master generate and send
+	everything. Both halves of a pad must be built the same way. */
+//#define OTP_SPLIT_RANDOMIZE
+
 /** Define exactly one of options below to indicate which NAND
 	chip the target board is using. */
 #define NAND_CHIP_S34ML01G2			// 2Gb Samsung SLC flash
@@ -0,0 +1,48 @@
+/*
+ * crc32.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: phooky
+ */
+
+#ifndef CRC32_H_
+#define CRC32_H_
+
+#include <stdint.h>
+
+/**
+ * CRC-32 with the IEEE 802.3 polynomial, bit-reflected, as zlib computes it.
+ * The twins use it to check that each block of pad data reached both chips
+ * intact. A CRC is built up a byte or a buffer at a time from CRC32_INIT, and
+ * crc32_finish gives the final value.
+ */
+#define CRC32_INIT 0xffffffffUL
+
+/** The CRC of each byte value; see crc32.c. */
+extern const uint32_t crc32_table[256];
+
+/**
+ * Add a byte to a running CRC.
+ * @param crc the running CRC
+ * @param b the next byte
+ * @return the updated CRC
+ */
+uint32_t crc32_byte(uint32_t crc, uint8_t b);
+
+/**
+ * Add a buffer to a running CRC.
+ * @param crc the running CRC
+ * @param data the next bytes
+ * @param count the number of bytes
+ * @return the updated CRC
+ */
+uint32_t crc32_update(uint32_t crc, const uint8_t* data, uint16_t count);
+
+/**
+ * Get the final value of a running CRC.
+ * @param crc the running CRC
+ * @return the CRC of all the bytes added to it
+ */
+uint32_t crc32_finish(uint32_t crc);
+
+#endif /* CRC32_H_ */
@@ -0,0 +1,83 @@
+#include "crc32.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#define TC 1000
+
+uint8_t buf[512];
+
+void prep_buffer() {
+  for (int i = 0; i < 512; i++) {
+    buf[i] = rand();
+  }
+}
+
+// Bit at a time, straight from the polynomial.
+uint32_t crc32_reference(const uint8_t* data, int count) {
+  uint32_t crc = 0xffffffff;
+  while (count--) {
+    crc ^= *(data++);
+    for (int bit = 0; bit < 8; bit++) {
+      crc = (crc & 1) ? ((crc >> 1) ^ 0xedb88320) : (crc >> 1);
+    }
+  }
+  return ~crc;
+}
+
+bool run_check_value_test() {
+  const uint8_t check[9] = { '1','2','3','4','5','6','7','8','9' };
+  return crc32_finish(crc32_update(CRC32_INIT, check, 9)) == 0xcbf43926;
+}
+
+bool run_reference_test() {
+  prep_buffer();
+  return crc32_finish(crc32_update(CRC32_INIT, buf, 512)) == crc32_reference(buf, 512);
+}
+
+// Building the CRC a byte at a time gives the same value as one buffer.
+bool run_bytewise_test() {
+  uint32_t crc = CRC32_INIT;
+  prep_buffer();
+  for (int i = 0; i < 512; i++) {
+    crc = crc32_byte(crc, buf[i]);
+  }
+  return crc == crc32_update(CRC32_INIT, buf, 512);
+}
+
+// Every burst of up to 32 flipped bits is detected.
+bool run_burst_test() {
+  uint32_t good, bad;
+  int start = rand() % (512 * 8 - 32);
+  int len = 1 + rand() % 32;
+  uint32_t mask = (len == 32) ? 0xffffffff : ((1u << len) - 1);
+  uint32_t pattern = (rand() & mask) | 1 | (1u << (len - 1));
+  prep_buffer();
+  good = crc32_update(CRC32_INIT, buf, 512);
+  for (int i = 0; i < len; i++) {
+    if (pattern & (1u << i)) buf[(start + i) / 8] ^= 1 << ((start + i) % 8);
+  }
+  bad = crc32_update(CRC32_INIT, buf, 512);
+  return good != bad;
+}
+
+void main() {
+  int passes;
+  printf("CRC-32 test start.\n");
+  printf("Check value: %s\n", run_check_value_test() ? "passed" : "FAILED");
+  passes = 0;
+  for (int i = 0; i < TC; i++) {
+    if (run_reference_test()) { passes++; }
+  }
+  printf("Reference: %d/%d passed.\n",passes,TC);
+  passes = 0;
+  for (int i = 0; i < TC; i++) {
+    if (run_bytewise_test()) { passes++; }
+  }
+  printf("Bytewise: %d/%d passed.\n",passes,TC);
+  passes = 0;
+  for (int i = 0; i < TC; i++) {
+    if (run_burst_test()) { passes++; }
+  }
+  printf("Bursts: %d/%d detected.\n",passes,TC);
+}
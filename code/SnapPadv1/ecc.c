@@ -22,25 +22,80 @@
  *  ---------------------------------------------------------
  */
 
-// Compute column parities
-static inline uint8_t column_parities(uint8_t b) {
-	uint8_t p;
-	// compute bits 2 and 3
-	uint8_t b23 = b ^ (b >> 4);
-	b23 ^= b23 >> 2; // bit 0 -> 2, bit 1 -> 3
-	p  = (b23 & 0x3) << 2;
-	// compute bits 4 and 5
-	uint8_t b45 = b ^ (b >>4);
-	b45 ^= b45 >> 1; // bit 0 -> bit 4, bit 2 -> bit 5;
-	p |= (b45 & 0x01) << 4;
-	p |= (b45 & 0x04) << 3;
-	// compute bits 6 and 7
-	uint8_t b67 = b ^ (b >> 2);
-	b67 ^= b67 >> 1; // bit 0 -> 6, bit 4 -> 7
-	p |= (b67 & 0x01) << 6;
-	p |= (b67 & 0x10) << 3;
-	return p;
+/**
+ * Parity of each byte value (1 if an odd number of bits are set). Used to
+ * decide whether a byte contributes to the line parities.
+ */
+const uint8_t ecc_parity_table[256] = {
+	0x00, 0x01, 0x01, 0x00, 0x01, 0x00, 0x00, 0x01, 0x01, 0x00, 0x00, 0x01, 0x00, 0x01, 0x01, 0x00,
+	0x01, 0x00, 0x00, 0x01, 0x00, 0x01, 0x01, 0x00, 0x00, 0x01, 0x01, 0x00, 0x01, 0x00, 0x00, 0x01,
+	0x01, 0x00, 0x00, 0x01, 0x00, 0x01, 0x01, 0x00, 0x00, 0x01, 0x01, 0x00, 0x01, 0x00, 0x00, 0x01,
+	0x00, 0x01, 0x01, 0x00, 0x01, 0x00, 0x00, 0x01, 0x01, 0x00, 0x00, 0x01, 0x00, 0x01, 0x01, 0x00,
+	0x01, 0x00, 0x00, 0x01, 0x00, 0x01, 0x01, 0x00, 0x00, 0x01, 0x01, 0x00, 0x01, 0x00, 0x00, 0x01,
+	0x00, 0x01, 0x01, 0x00, 0x01, 0x00, 0x00, 0x01, 0x01, 0x00, 0x00, 0x01, 0x00, 0x01, 0x01, 0x00,
+	0x00, 0x01, 0x01, 0x00, 0x01, 0x00, 0x00, 0x01, 0x01, 0x00, 0x00, 0x01, 0x00, 0x01, 0x01, 0x00,
+	0x01, 0x00, 0x00, 0x01, 0x00, 0x01, 0x01, 0x00, 0x00, 0x01, 0x01, 0x00, 0x01, 0x00, 0x00, 0x01,
+	0x01, 0x00, 0x00, 0x01, 0x00, 0x01, 0x01, 0x00, 0x00, 0x01, 0x01, 0x00, 0x01, 0x00, 0x00, 0x01,
+	0x00, 0x01, 0x01, 0x00, 0x01, 0x00, 0x00, 0x01, 0x01, 0x00, 0x00, 0x01, 0x00, 0x01, 0x01, 0x00,
+	0x00, 0x01, 0x01, 0x00, 0x01, 0x00, 0x00, 0x01, 0x01, 0x00, 0x00, 0x01, 0x00, 0x01, 0x01, 0x00,
+	0x01, 0x00, 0x00, 0x01, 0x00, 0x01, 0x01, 0x00, 0x00, 0x01, 0x01, 0x00, 0x01, 0x00, 0x00, 0x01,
+	0x00, 0x01, 0x01, 0x00, 0x01, 0x00, 0x00, 0x01, 0x01, 0x00, 0x00, 0x01, 0x00, 0x01, 0x01, 0x00,
+	0x01, 0x00, 0x00, 0x01, 0x00, 0x01, 0x01, 0x00, 0x00, 0x01, 0x01, 0x00, 0x01, 0x00, 0x00, 0x01,
+	0x01, 0x00, 0x00, 0x01, 0x00, 0x01, 0x01, 0x00, 0x00, 0x01, 0x01, 0x00, 0x01, 0x00, 0x00, 0x01,
+	0x00, 0x01, 0x01, 0x00, 0x01, 0x00, 0x00, 0x01, 0x01, 0x00, 0x00, 0x01, 0x00, 0x01, 0x01, 0x00
+};
+/**
+ * Column parities (CP0-CP5, already shifted into bits 2-7 of ECC byte 2) of
+ * each byte value. Column parity is linear, so the parities of a whole buffer
+ * are the parities of the XOR of all its bytes; one lookup per paragraph.
+ */
+static const uint8_t ecc_column_table[256] = {
+	0x00, 0x54, 0x58, 0x0c, 0x64, 0x30, 0x3c, 0x68, 0x68, 0x3c, 0x30, 0x64, 0x0c, 0x58, 0x54, 0x00,
+	0x94, 0xc0, 0xcc, 0x98, 0xf0, 0xa4, 0xa8, 0xfc, 0xfc, 0xa8, 0xa4, 0xf0, 0x98, 0xcc, 0xc0, 0x94,
+	0x98, 0xcc, 0xc0, 0x94, 0xfc, 0xa8, 0xa4, 0xf0, 0xf0, 0xa4, 0xa8, 0xfc, 0x94, 0xc0, 0xcc, 0x98,
+	0x0c, 0x58, 0x54, 0x00, 0x68, 0x3c, 0x30, 0x64, 0x64, 0x30, 0x3c, 0x68, 0x00, 0x54, 0x58, 0x0c,
+	0xa4, 0xf0, 0xfc, 0xa8, 0xc0, 0x94, 0x98, 0xcc, 0xcc, 0x98, 0x94, 0xc0, 0xa8, 0xfc, 0xf0, 0xa4,
+	0x30, 0x64, 0x68, 0x3c, 0x54, 0x00, 0x0c, 0x58, 0x58, 0x0c, 0x00, 0x54, 0x3c, 0x68, 0x64, 0x30,
+	0x3c, 0x68, 0x64, 0x30, 0x58, 0x0c, 0x00, 0x54, 0x54, 0x00, 0x0c, 0x58, 0x30, 0x64, 0x68, 0x3c,
+	0xa8, 0xfc, 0xf0, 0xa4, 0xcc, 0x98, 0x94, 0xc0, 0xc0, 0x94, 0x98, 0xcc, 0xa4, 0xf0, 0xfc, 0xa8,
+	0xa8, 0xfc, 0xf0, 0xa4, 0xcc, 0x98, 0x94, 0xc0, 0xc0, 0x94, 0x98, 0xcc, 0xa4, 0xf0, 0xfc, 0xa8,
+	0x3c, 0x68, 0x64, 0x30, 0x58, 0x0c, 0x00, 0x54, 0x54, 0x00, 0x0c, 0x58, 0x30, 0x64, 0x68, 0x3c,
+	0x30, 0x64, 0x68, 0x3c, 0x54, 0x00, 0x0c, 0x58, 0x58, 0x0c, 0x00, 0x54, 0x3c, 0x68, 0x64, 0x30,
+	0xa4, 0xf0, 0xfc, 0xa8, 0xc0, 0x94, 0x98, 0xcc, 0xcc, 0x98, 0x94, 0xc0, 0xa8, 0xfc, 0xf0, 0xa4,
+	0x0c, 0x58, 0x54, 0x00, 0x68, 0x3c, 0x30, 0x64, 0x64, 0x30, 0x3c, 0x68, 0x00, 0x54, 0x58, 0x0c,
+	0x98, 0xcc, 0xc0, 0x94, 0xfc, 0xa8, 0xa4, 0xf0, 0xf0, 0xa4, 0xa8, 0xfc, 0x94, 0xc0, 0xcc, 0x98,
+	0x94, 0xc0, 0xcc, 0x98, 0xf0, 0xa4, 0xa8, 0xfc, 0xfc, 0xa8, 0xa4, 0xf0, 0x98, 0xcc, 0xc0, 0x94,
+	0x00, 0x54, 0x58, 0x0c, 0x64, 0x30, 0x3c, 0x68, 0x68, 0x3c, 0x30, 0x64, 0x0c, 0x58, 0x54, 0x00
+};
+
+/**
+ * Reset a running SEC-DED code before the first byte of a paragraph.
+ * @param state the running code to reset
+ */
+void ecc_begin(EccState* state) {
+	state->line = 0;
+	state->column = 0;
+	state->odd = 0;
 }
+
+/**
+ * Produce the 25-bit SEC-DED code for all the bytes fed to a running code.
+ * @param state the running code, after all 512 bytes have been added
+ * @return the ECC
+ */
+uint32_t ecc_finish(const EccState* state) {
+	uint8_t ecc[4];
+	// LP0/2/../14 are the complement of LP1/3/../15 for every odd byte
+	ecc[0] = state->line & 0xff;
+	ecc[1] = ecc[0] ^ (state->odd?0xff:0x00);
+	ecc[2] = ecc_column_table[state->column];
+	ecc[2] |= (state->line & 0x100)?0x02:0x00;
+	ecc[2] ^= ((state->line >> 8) ^ state->odd) & 0x01;
+	// extended bit: odd byte count plus the parity of ecc[0-1]
+	ecc[3] = state->odd ^ ecc_parity_table[ecc[0]] ^ ecc_parity_table[ecc[1]];
+	return ((uint32_t)ecc[3] << 24) | ((uint32_t)ecc[2] << 16) | ((uint32_t)ecc[1] << 8) | ecc[0];
+}
+
 /**
  * Generate a 25-bit SEC-DED code for a 512 byte buffer.
  * @param buffer the 512B buffer to generate an ECC for
@@ -48,30 +103,12 @@ static inline uint8_t column_parities(uint8_t b) {
  */
 uint32_t ecc_generate(uint8_t* buffer) {
 	uint16_t idx;
-	uint8_t ecc[4] = {0,0,0,0};
+	EccState state;
+	ecc_begin(&state);
 	for (idx = 0;idx < 512;idx++) {
-		uint8_t c = buffer[idx];
-		// compute line parity
-		uint8_t x = c ^ (c>>4);
-		x ^= (x>>2);
-		x ^= (x>>1);
-		x = (x & 0x01)?0xff:0x00;
-		ecc[0] ^= idx & x;
-		ecc[1] ^= ~idx & x;
-        ecc[2] ^= ((idx & 0x100)?0x02:0x01) & x;
-		// compute column parities
-		ecc[2] ^= column_parities(c);
-        // compute extended bit
-        ecc[3] ^= x & 0x01;
+		ecc_update(&state,idx,buffer[idx]);
 	}
-    // add ecc[0-2] to extended parity
-    for (idx=0; idx<2; idx++) {
-    	uint8_t x = ecc[idx] ^ (ecc[idx]>>4);
-		x ^= (x>>2);
-        x ^= (x>>1);
-        ecc[3] ^= x & 0x01;
-    }
-	return ((uint32_t)ecc[3] << 24) | ((uint32_t)ecc[2] << 16) | ((uint32_t)ecc[1] << 8) | ecc[0];
+	return ecc_finish(&state);
 }
 
 /**
@@ -82,8 +119,22 @@ uint32_t ecc_generate(uint8_t* buffer) {
  * @return true if no error or the error was corrected; false if the buffer has multi-bit errors.
  */
 bool ecc_verify(uint8_t* buffer, uint32_t code) {
-	uint32_t ecc_comp = ecc_generate(buffer) ^ code;
-	if (ecc_comp == 0) return true; // No error
+	return ecc_correct(buffer,ecc_generate(buffer),code) >= 0;
+}
+
+/**
+ * Verify and correct a 512 byte buffer whose code has already been computed (for
+ * instance while it was read off the bus). If an error can be corrected, it will be
+ * fixed in the passed buffer.
+ * @param buffer the 512B buffer to correct
+ * @param computed the ECC computed over the buffer as it stands
+ * @param code the stored ECC code to verify with
+ * @return the number of data bits corrected (0 if there was no error, or the error
+ * was in the stored code), or -1 if the buffer has multi-bit errors.
+ */
+int8_t ecc_correct(uint8_t* buffer, uint32_t computed, uint32_t code) {
+	uint32_t ecc_comp = computed ^ code;
+	if (ecc_comp == 0) return 0; // No error
 	// Count yon bits
 	uint8_t i, bits;
 	for (bits=i=0;i<24;i++) {
@@ -91,17 +142,17 @@ bool ecc_verify(uint8_t* buffer, uint32_t code) {
 	}
 	if (bits == 1) {
 		// ECC code is corrupted
-		return true;
+		return 0;
 	}
 	if (bits == 12) {
 		// Do correction
-		if ((ecc_comp & (uint32_t)1<<24) == 0) return false; // Check extended DED bit
+		if ((ecc_comp & (uint32_t)1<<24) == 0) return -1; // Check extended DED bit
 		uint8_t bit = ((ecc_comp & (uint32_t)1<<23)?4:0) |
 				((ecc_comp & (uint32_t)1<<21)?2:0) |
 				((ecc_comp & (uint32_t)1<<19)?1:0);
 		uint16_t idx = ((ecc_comp & (uint32_t)1 << 17)?0x100:0) | (ecc_comp&0xff);
 		buffer[idx] ^= 1 << bit;
-		return true;
+		return 1;
 	}
-	return false;
+	return -1;
 }
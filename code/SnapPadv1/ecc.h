@@ -11,6 +11,46 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+/** Parity of each byte value; shared with the inline running code below. */
+extern const uint8_t ecc_parity_table[256];
+
+/**
+ * Running state of a SEC-DED code that is built up one byte at a time, so that
+ * the code can be computed while the data is clocked on or off the NAND bus.
+ */
+typedef struct {
+	uint16_t line;  // XOR of the indices of all odd-parity bytes
+	uint8_t column; // XOR of all bytes
+	uint8_t odd;    // parity of the number of odd-parity bytes
+} EccState;
+
+/**
+ * Reset a running SEC-DED code before the first byte of a paragraph.
+ * @param state the running code to reset
+ */
+void ecc_begin(EccState* state);
+
+/**
+ * Add one byte to a running SEC-DED code.
+ * @param state the running code
+ * @param idx the offset of the byte within the 512B paragraph
+ * @param c the byte value
+ */
+static inline void ecc_update(EccState* state, uint16_t idx, uint8_t c) {
+	state->column ^= c;
+	if (ecc_parity_table[c]) {
+		state->line ^= idx;
+		state->odd ^= 1;
+	}
+}
+
+/**
+ * Produce the 25-bit SEC-DED code for all the bytes fed to a running code.
+ * @param state the running code, after all 512 bytes have been added
+ * @return the ECC
+ */
+uint32_t ecc_finish(const EccState* state);
+
 /**
  * Generate a 25-bit SEC-DED code for a 512 byte buffer.
  * @param buffer the 512B buffer to generate an ECC for
@@ -27,4 +67,16 @@ uint32_t ecc_generate(uint8_t* buffer);
  */
 bool ecc_verify(uint8_t* buffer, uint32_t code);
 
+/**
+ * Verify and correct a 512 byte buffer whose code has already been computed (for
+ * instance while it was read off the bus). If an error can be corrected, it will be
+ * fixed in the passed buffer.
+ * @param buffer the 512B buffer to correct
+ * @param computed the ECC computed over the buffer as it stands
+ * @param code the stored ECC code to verify with
+ * @return the number of data bits corrected (0 if there was no error, or the error
+ * was in the stored code), or -1 if the buffer cannot be fixed.
+ */
+int8_t ecc_correct(uint8_t* buffer, uint32_t computed, uint32_t code);
+
 #endif /* ECC_H_ */
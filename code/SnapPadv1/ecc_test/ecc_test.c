@@ -2,6 +2,10 @@
 #include <stdio.h>
 #include <time.h>
 #include <stdlib.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC
+#endif
 
 
 uint8_t buf1[512];
@@ -56,6 +60,16 @@ bool run_crc_err_test() {
   return ecc_verify(buf2, ecc);
 }
 
+// Only an error in the data counts as a corrected bit, not one in the stored code.
+bool run_count_test() {
+  prep_buffers();
+  uint32_t ecc = ecc_generate(buf1);
+  if (ecc_correct(buf2, ecc_generate(buf2), ecc) != 0) return false;
+  if (ecc_correct(buf2, ecc_generate(buf2), ecc ^ (0x1 << (rand()%24))) != 0) return false;
+  buf2[rand()%512] ^= 0x01 << (rand()%8);
+  return ecc_correct(buf2, ecc_generate(buf2), ecc) == 1 && check_buffers();
+}
+
 bool run_2_err_test() {
   prep_buffers();
   uint32_t ecc = ecc_generate(buf1);
@@ -88,6 +102,95 @@ int count_bits(uint32_t v) {
   return bits;
 }
 
+// Reference copy of the original shift/fold generator, used to check that
+// the table-driven ecc_generate() produces identical codes and to compare
+// throughput.
+static inline uint8_t column_parities_ref(uint8_t b) {
+  uint8_t p;
+  uint8_t b23 = b ^ (b >> 4);
+  b23 ^= b23 >> 2;
+  p  = (b23 & 0x3) << 2;
+  uint8_t b45 = b ^ (b >>4);
+  b45 ^= b45 >> 1;
+  p |= (b45 & 0x01) << 4;
+  p |= (b45 & 0x04) << 3;
+  uint8_t b67 = b ^ (b >> 2);
+  b67 ^= b67 >> 1;
+  p |= (b67 & 0x01) << 6;
+  p |= (b67 & 0x10) << 3;
+  return p;
+}
+
+uint32_t ecc_generate_ref(uint8_t* buffer) {
+  uint16_t idx;
+  uint8_t ecc[4] = {0,0,0,0};
+  for (idx = 0;idx < 512;idx++) {
+    uint8_t c = buffer[idx];
+    uint8_t x = c ^ (c>>4);
+    x ^= (x>>2);
+    x ^= (x>>1);
+    x = (x & 0x01)?0xff:0x00;
+    ecc[0] ^= idx & x;
+    ecc[1] ^= ~idx & x;
+    ecc[2] ^= ((idx & 0x100)?0x02:0x01) & x;
+    ecc[2] ^= column_parities_ref(c);
+    ecc[3] ^= x & 0x01;
+  }
+  for (idx=0; idx<2; idx++) {
+    uint8_t x = ecc[idx] ^ (ecc[idx]>>4);
+    x ^= (x>>2);
+    x ^= (x>>1);
+    ecc[3] ^= x & 0x01;
+  }
+  return ((uint32_t)ecc[3] << 24) | ((uint32_t)ecc[2] << 16) | ((uint32_t)ecc[1] << 8) | ecc[0];
+}
+
+bool run_ref_test() {
+  prep_buffers();
+  return ecc_generate(buf1) == ecc_generate_ref(buf1);
+}
+
+bool run_sparse_ref_test() {
+  // single set bits exercise every line/column parity position
+  zero_buffers();
+  buf1[rand()%512] = 0x01 << (rand()%8);
+  return ecc_generate(buf1) == ecc_generate_ref(buf1);
+}
+
+#define BENCH_PARAS 200000
+
+volatile uint32_t bench_sink;
+
+// Time n paragraphs through the given generator; returns seconds and stores
+// TSC cycles per paragraph (0 where no TSC is available).
+double bench(uint32_t (*gen)(uint8_t*), double* cycles) {
+  prep_buffers();
+  clock_t start = clock();
+#ifdef HAVE_TSC
+  uint64_t tsc = __rdtsc();
+#endif
+  for (int i = 0; i < BENCH_PARAS; i++) {
+    buf1[i & 511] ^= i;
+    bench_sink ^= gen(buf1);
+  }
+#ifdef HAVE_TSC
+  *cycles = (double)(__rdtsc() - tsc) / BENCH_PARAS;
+#else
+  *cycles = 0;
+#endif
+  return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+void run_bench() {
+  double ref_cyc, tbl_cyc;
+  double ref_t = bench(ecc_generate_ref, &ref_cyc);
+  double tbl_t = bench(ecc_generate, &tbl_cyc);
+  printf("Throughput (%d paragraphs):\n", BENCH_PARAS);
+  printf("  shift/fold: %8.1f ns/para %8.1f cycles/para\n", ref_t * 1e9 / BENCH_PARAS, ref_cyc);
+  printf("  table:      %8.1f ns/para %8.1f cycles/para\n", tbl_t * 1e9 / BENCH_PARAS, tbl_cyc);
+  printf("  saved:      %8.1f cycles/para (%.2fx)\n", ref_cyc - tbl_cyc, ref_t / tbl_t);
+}
+
 #define TC 100000
 
 void main() {
@@ -109,9 +212,19 @@ void main() {
   }
   printf("CRC error: %d/%d passed.\n",passes,TC);
   passes = 0;
+  for (int t=0;t<TC;t++) {
+    if (run_count_test()) { passes++; }
+  }
+  printf("Correction count: %d/%d passed.\n",passes,TC);
+  passes = 0;
   for (int t=0;t<TC;t++) {
     if (run_2_err_test()) { passes++; }
   }
   printf("Two errors: %d/%d passed.\n",passes,TC);
+  passes = 0;
+  for (int t=0;t<TC;t++) {
+    if (run_ref_test() && run_sparse_ref_test()) { passes++; }
+  }
+  printf("Reference match: %d/%d passed.\n",passes,TC);
+  run_bench();
 }
-
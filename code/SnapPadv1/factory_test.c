@@ -242,7 +242,7 @@ void scan_bb() {
 
 void scan_used() {
 	uint16_t block;
-	for (block = 1; block < 2048; block++) {
+	for (block = 1; block < nand_geometry.block_count; block++) {
 		uint8_t r = otp_get_block_status(block);
 		if (r != BU_UNUSED_BLOCK) {
 			print_usb_str("USED ");
@@ -373,7 +373,7 @@ void do_usb_command(uint8_t* cmdbuf, uint16_t len) {
 			// 4. Write test pattern to all paragraphs and pages in block
 			for (page = 0; page < PAGE_COUNT; page++) {
 				for (para = 0; para < 4; para++) {
-					if (!nand_save_para(block,page,para)) {
+					if (!nand_cache_para(block,page,para)) {
 						print_usb_dec(block); print_usb_str(" save error: ");
 						error();
 						return;
@@ -383,13 +383,13 @@ void do_usb_command(uint8_t* cmdbuf, uint16_t len) {
 			nand_wait_for_ready();
 			// 5. Read and verify pattern from all paragraphs and pages in block
 			for (page = 0; page < PAGE_COUNT; page++) {
+				nand_load_page(block,page);
 				for (para = 0; para < 4; para++) {
-					if (!nand_load_para(block,page,para)) {
+					if (!nand_page_para(para)) {
 						print_usb_dec(block); print_usb_str(" load error: ");
 						error();
 						return;
 					}
-					nand_wait_for_ready();
 					for (i = 0; i < PARA_SIZE; i++) {
 						if (buf[i] != (((i>>1) ^ i) & 0xff)) {
 							print_usb_dec(block); print_usb_str(" data error: ");
@@ -423,16 +423,17 @@ void do_usb_command(uint8_t* cmdbuf, uint16_t len) {
 				buffers_swap();
 				// restart rng
 				hwrng_bits_start(buffers_get_rng(),512);
-				// write to local nand
-				nand_save_para(block,page,para);
-				// wait for write completion
-				nand_wait_for_ready();
+				// write to local nand, one program per page
+				nand_cache_para(block,page,para);
 			}
 		}
+		// wait for write completion
+		nand_wait_for_ready();
 		// 3. Read and return the block of random data
 		for (page = 0; page < PAGE_COUNT; page++) {
+			nand_load_page(block,page);
 			for (para = 0; para < 4; para++) {
-				if (!nand_load_para(block,page,para)) {
+				if (!nand_page_para(para)) {
 					error();
 					return;
 				}
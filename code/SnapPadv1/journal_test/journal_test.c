@@ -0,0 +1,83 @@
+#include "nand_sim.h"
+#include "nand.h"
+#include "buffers.h"
+#include "onetimepad.h"
+#include <stdio.h>
+
+#define BLOCKS 512
+/** Provisions run past the blocks the cursor journal can cover. */
+#define PROVISIONS (240 * PAGE_COUNT)
+/** Provisions between restarts; not a divisor of the page count, so restarts fall
+    at every point of a block. */
+#define RESTART_EVERY 997
+
+bool page_used(uint16_t block, uint16_t page) {
+  uint8_t mark;
+  nand_read_raw_page(nand_make_para_addr(block,page,0)+PARA_SIZE+PARA_SPARE_SIZE-1,&mark,1);
+  return mark != 0xff;
+}
+
+/** The page a half provisions n-th: A from the front of the chip, B from the back. */
+void nth_page(bool is_A, uint32_t n, uint16_t* block, uint16_t* page) {
+  *block = is_A?(1 + n / PAGE_COUNT):(BLOCKS - 1 - n / PAGE_COUNT);
+  *page = is_A?(n % PAGE_COUNT):(PAGE_COUNT - 1 - n % PAGE_COUNT);
+}
+
+// Provisioning takes every page in order, whether a restart finds the journal
+// with room or full, and a restart with it full costs no more than a page search.
+bool run_restart_test(bool is_A) {
+  NandSimConfig config = nand_sim_default_config();
+  uint32_t n, reads;
+  uint32_t room_reads = 0, full_reads = 0;
+  uint16_t block, page;
+  if (!nand_sim_open("journal_test.img", BLOCKS, true, &config)) {
+    printf("Can't open the image\n");
+    return false;
+  }
+  buffers_init();
+  nand_init();
+  otp_initialize_header(is_A);
+  for (n = 0; n < PROVISIONS; n++) {
+    const bool restart = (n % RESTART_EVERY) == 0;
+    if (restart) {
+      nand_reset_stats();
+      otp_load_metadata();
+    }
+    otp_provision(1, is_A);
+    if (restart) {
+      reads = nand_get_stats()->array_reads;
+      if (n / PAGE_COUNT < 160) {
+        if (reads > room_reads) room_reads = reads;
+      } else if (n / PAGE_COUNT > 224) {
+        if (reads > full_reads) full_reads = reads;
+      }
+    }
+    nth_page(is_A, n, &block, &page);
+    if (!page_used(block, page)) {
+      printf("Half %c: page %u of block %u not provisioned after %u provisions\n",
+          is_A?'A':'B', page, block, n + 1);
+      nand_sim_close();
+      return false;
+    }
+    nth_page(is_A, n + 1, &block, &page);
+    if (page_used(block, page)) {
+      printf("Half %c: page %u of block %u provisioned early after %u provisions\n",
+          is_A?'A':'B', page, block, n + 1);
+      nand_sim_close();
+      return false;
+    }
+  }
+  nand_sim_close();
+  printf("Half %c: %u provisions; restarts take up to %u reads with the journal's room, %u full.\n",
+      is_A?'A':'B', PROVISIONS, room_reads, full_reads);
+  return full_reads <= room_reads + PAGE_BITS + 1;
+}
+
+int main(int argc, char** argv) {
+  int failures = 0;
+  printf("Journal test start.\n");
+  if (!run_restart_test(true)) { failures++; }
+  if (!run_restart_test(false)) { failures++; }
+  printf("%d failures.\n",failures);
+  return failures;
+}
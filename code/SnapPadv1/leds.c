@@ -123,13 +123,13 @@ void wait_for_confirm() {
 	while (has_confirm()); // wait for button to be released
 }
 
-bool confirm_count(uint8_t count) {
+bool confirm_count(uint32_t count) {
 	// Before we start, make sure the button is released
 	timer_reset();
 	while (has_confirm()) {
 		if  (timer_msec() >= 1000) { return false; } // you get a second to take your finger off the button
 	}
-	leds_set_mode(LM_CONFIRM_1 + (count-1));
+	leds_set_mode(LM_CONFIRM_1 + ((count < LED_COUNT)?count:LED_COUNT) - 1);
 	timer_reset();
 	while (!has_confirm()) {
 		if (timer_msec() >= 10000) {
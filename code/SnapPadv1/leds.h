@@ -86,8 +86,9 @@ void wait_for_confirm();
 
 /**
  * Give the user ten seconds to confirm releasing blocks. The a number of LEDs
- * flash proportional to the number of blocks to release.
+ * flash proportional to the number of blocks to release; counts of LED_COUNT
+ * or more flash them all.
  */
-bool confirm_count(uint8_t count);
+bool confirm_count(uint32_t count);
 
 #endif /* LEDS_H_ */
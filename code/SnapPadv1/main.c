@@ -275,6 +275,9 @@ void diagnostics() {
 		error("ONFI failure");
 		return;
 	}
+	print_usb_str("Chip blocks:");
+	print_usb_dec(nand_geometry.block_count);
+	print_usb_str(nand_geometry.onfi?"\n":" (default)\n");
 	// check otp
 	OTPConfig config = otp_read_header();
 	if (!config.has_header) {
@@ -321,7 +324,7 @@ void scan_bb() {
 
 void scan_used() {
 	uint16_t block;
-	for (block = 1; block < 2048; block++) {
+	for (block = 1; block < nand_geometry.block_count; block++) {
 		uint8_t r = otp_get_block_status(block);
 		if (r != BU_UNUSED_BLOCK) {
 			if (r == BU_BAD_BLOCK) {
@@ -347,6 +350,76 @@ void read_rng() {
 	}
 }
 
+#ifdef NAND_STATS
+void print_stat(const char* name, uint32_t value) {
+	print_usb_str(name);
+	print_usb_str(" ");
+	print_usb_dec(value);
+	print_usb_str("\n");
+}
+
+/**
+ * Print the NAND operation counters, then the pipeline stalls of the last
+ * randomization (see RandomizeStats), one "name value" line each.
+ */
+void print_nand_stats() {
+	const NandStats* stats = nand_get_stats();
+	const RandomizeStats* rnd = otp_get_randomize_stats();
+	print_usb_str("BEGIN STATS\n");
+	print_stat("reads",stats->array_reads);
+	print_stat("programs",stats->page_programs);
+	print_stat("partial_programs",stats->partial_programs);
+	print_stat("erases",stats->erases);
+	print_stat("bytes_in",stats->bytes_in);
+	print_stat("bytes_out",stats->bytes_out);
+	print_stat("corrected_bits",stats->corrected_bits);
+	print_stat("ecc_failures",stats->ecc_failures);
+	print_stat("busy_waits",stats->busy_waits);
+	print_stat("busy_usec",stats->busy_usec);
+	print_stat("rnd_paragraphs",rnd->paragraphs);
+	print_stat("rnd_run_usec",rnd->run_usec);
+	print_stat("rnd_rng_usec",rnd->rng_usec);
+	print_stat("rnd_uart_usec",rnd->uart_usec);
+	print_stat("rnd_nand_usec",rnd->nand_usec);
+	print_stat("rnd_ack_usec",rnd->ack_usec);
+	print_usb_str("END STATS\n");
+}
+#endif
+
+#ifdef DEBUG
+/**
+ * Measure and print the NAND bus throughput. With NAND_DMA each strobe timing profile is
+ * measured in turn, starting with the mode 0 timing, and the chip's own profile is restored.
+ */
+void print_throughput(uint16_t block) {
+	NandThroughput t;
+#ifdef NAND_DMA
+	const NandTimingProfile chip_profile = nand_get_timing();
+	NandTimingProfile profile;
+	for (profile = NAND_TIMING_MODE0; profile <= NAND_TIMING_FAST; profile++) {
+		nand_set_timing(profile);
+		print_usb_str("Profile ");
+		print_usb_dec(profile);
+		print_usb_str((profile == chip_profile)?" (in use)":"");
+#else
+	{
+		print_usb_str("CPU");
+#endif
+		t = nand_measure_throughput(block);
+		print_usb_str(": read ");
+		print_usb_dec(t.read);
+		print_usb_str(" program ");
+		print_usb_dec(t.program);
+		print_usb_str(" zero ");
+		print_usb_dec(t.zero);
+		print_usb_str(" bytes/ms\n");
+	}
+#ifdef NAND_DMA
+	nand_set_timing(chip_profile);
+#endif
+}
+#endif
+
 uint32_t parseDec(uint8_t* buf, uint8_t* idx, uint8_t len) {
 	uint32_t val = 0;
 	for (; (*idx < len) && (buf[*idx] >= '0') && (buf[*idx] <= '9'); (*idx)++) {
@@ -354,6 +427,42 @@ uint32_t parseDec(uint8_t* buf, uint8_t* idx, uint8_t len) {
 	}
 	return val;
 }
+/**
+ * Walk the page list of a retrieve command: entries of the form page or first-last,
+ * separated by commas. A range runs from its first page to its last, up or down.
+ * @param buf the command
+ * @param len the length of the command
+ * @param retrieve true to retrieve the pages; false to only check the list
+ * @return the number of pages in the list, or 0 if any of them is out of range
+ */
+uint32_t walk_page_ranges(uint8_t* buf, uint8_t len, bool retrieve) {
+	const uint32_t page_limit = nand_page_number(nand_geometry.block_count,0);
+	uint8_t idx = 1;
+	uint32_t total = 0;
+	while (true) {
+		uint32_t page = parseDec(buf,&idx,len);
+		uint32_t last = page;
+		if (idx < len && buf[idx] == '-') {
+			idx++;
+			last = parseDec(buf,&idx,len);
+		}
+		// validate
+		if (page < PAGE_COUNT || page >= page_limit || last < PAGE_COUNT || last >= page_limit) {
+			return 0;
+		}
+		total += ((page < last)?(last - page):(page - last)) + 1;
+		if (retrieve) {
+			while (true) {
+				otp_retrieve(page);
+				if (page == last) break;
+				if (page < last) { page++; } else { page--; }
+			}
+		}
+		if (idx >= len || buf[idx++] != ',') break;
+	}
+	return total;
+}
+
 /*
 // Read paragraph. Parameters are a comma separated list: block, page, paragraph.
 bool parseBPP(uint8_t* buf, uint8_t* idx, uint8_t len, uint16_t* block, uint8_t* page, uint8_t* para) {
@@ -373,19 +482,28 @@ bool parseBPP(uint8_t* buf, uint8_t* idx, uint8_t len, uint16_t* block, uint8_t*
  * V                       - return a string describing the version of the firmware
  * D                       - diagnostics
  * #                       - produce 64 bytes of random data from the RNG
- * Rpage,[page,page,page]  - retrieve (and zero) the page(s) specified by "page".
- *                           maximum count is 4. will wait for user button press before continuing.
- * Pcount                  - provision (and zero) count paragraphs. snap-pad chooses next available paras.
- *                           maximum count is 4. will wait for user button press before continuing.
+ * Rpages[,pages...]       - retrieve (and zero) the pages specified. each entry is a page number, or a
+ *                           range "first-last" running up or down. will wait for user button press
+ *                           before continuing, then stream the pages back to back.
+ * Pcount                  - provision (and zero) count pages. snap-pad chooses next available pages.
+ *                           will wait for user button press before continuing, then stream the pages
+ *                           back to back.
  *
  * Additional debug build commands:
  * C                        - print the bad block list
  * U                        - print the used block list
- * cblock                   - print the checksum of the indicated block
+ * cblock                   - print the CRC-32 of the indicated block's data and the time taken
  * Mblock                   - mark the given block as used
  * F                        - find the address of the next block containing provisionable paras
  * rblock,page,para         - read the given block, page, and paragraph without erasing
  * Eblock                   - erase the indicated block (0xff everywhere)
+ * Bblock                   - measure NAND bus throughput in bytes/ms, using the indicated
+ *                            block as scratch, for each strobe timing profile
+ *
+ * Additional commands when NAND_STATS is defined (debug builds by default):
+ * S                        - print the NAND operation counters and the last randomization's
+ *                            pipeline stalls
+ * Sr                       - print the NAND operation counters, then zero them
  */
 
 void do_usb_command(uint8_t* cmdbuf, uint16_t len) {
@@ -401,10 +519,10 @@ void do_usb_command(uint8_t* cmdbuf, uint16_t len) {
 #endif
 		print_usb_str("\n");
 	} else if (cmdbuf[0] == 'P') {
-		// provision 'count' blocks.
+		// provision 'count' pages.
 		uint8_t idx = 1;
-		uint16_t count = parseDec(cmdbuf,&idx,len);
-		if (count == 0 || count > 4) {
+		uint32_t count = parseDec(cmdbuf,&idx,len);
+		if (count == 0) {
 			error("bad count");
 			return;
 		}
@@ -416,35 +534,29 @@ void do_usb_command(uint8_t* cmdbuf, uint16_t len) {
 			timeout();
 		}
 	} else if (cmdbuf[0] == 'R') {
-		// retrieve the specified pages
-		uint8_t idx = 1;
-		uint32_t page[4];
-		uint8_t count = 0;
-		uint8_t i;
-		// parse format: page# ["," page#]*
-		while (true) {
-			page[count] = parseDec(cmdbuf,&idx,len);
-			// validate
-			if (page[count] < PAGE_COUNT ||
-				page[count] >= BLOCK_COUNT * PAGE_COUNT) {
-				error("RANGE");
-				return;
-			}
-			count++;
-			if (count == 4) break;
-			if (cmdbuf[idx++] != ',') break;
+		// retrieve the specified pages. The whole list is checked before the
+		// button press, then walked again to release the pages.
+		uint32_t count = walk_page_ranges(cmdbuf,len,false);
+		if (count == 0) {
+			error("RANGE");
+			return;
 		}
 		if (confirm_count(count)) {
 			leds_set_mode(LM_ACKNOWLEDGED);
-			for (i = 0; i < count; i++) {
-				otp_retrieve(page[i]);
-			}
+			walk_page_ranges(cmdbuf,len,true);
 			leds_set_mode(LM_READY);
 		} else {
 			timeout();
 		}
 	} else if (cmdbuf[0] == '#') {
 		read_rng();
+#ifdef NAND_STATS
+	} else if (cmdbuf[0] == 'S') {
+		print_nand_stats();
+		if (len > 1 && cmdbuf[1] == 'r') {
+			nand_reset_stats();
+		}
+#endif
 #ifdef DEBUG
 	} else if (cmdbuf[0] == 'C') {
 		scan_bb();
@@ -455,12 +567,19 @@ void do_usb_command(uint8_t* cmdbuf, uint16_t len) {
 		uint8_t idx = 1;
 		uint16_t block = parseDec(cmdbuf,&idx,len);
 		struct checksum_ret sum;
+		uint16_t start;
 		print_usb_str("Starting checksum\n");
+		start = timer_msec();
 		sum = nand_block_checksum(block);
+		start = timer_msec() - start;
 		if (sum.ok) {
 			print_usb_str("Finished checksum ");
-			print_usb_dec(sum.checksum);
-			print_usb_str("\n");
+			print_usb_dec(sum.crc);
+			print_usb_str(" corrected bits ");
+			print_usb_dec(sum.corrected);
+			print_usb_str(" in ");
+			print_usb_dec(start);
+			print_usb_str("ms\n");
 		} else {
 			print_usb_str("Bad checksum/read\n");
 		}
@@ -475,17 +594,25 @@ void do_usb_command(uint8_t* cmdbuf, uint16_t len) {
 	} else if (cmdbuf[0] == 'F') {
 		// find next available block
 		uint16_t block = otp_find_unmarked_block(!config.is_A);
+		uint16_t page;
 		print_usb_str("Next unused block ");
 		print_usb_dec(block);
-		print_usb_str("\n");
+		if (block != 0xffff && otp_find_unmarked_page(block,&page,!config.is_A)) {
+			print_usb_str(" page ");
+			print_usb_dec(page);
+		}
+		print_usb_str(" (");
+		print_usb_dec(otp_page_probes());
+		print_usb_str(" probes)\n");
 	} else if (cmdbuf[0] == 'r') {
 		// Read page. Parameter is the page index.
 		uint32_t page = 0;
 		uint8_t para;
 		uint8_t idx = 1;
 		page = parseDec(cmdbuf,&idx,len);
+		nand_load_page(nand_page_block(page),nand_page_index(page));
 		for (para = 0; para < 4; para++) {
-			if (nand_load_para(page/PAGE_COUNT,page%PAGE_COUNT,para)) {
+			if (nand_page_para(para)) {
 				cdcSendDataWaitTilDone((BYTE*)buffers_get_nand(),512,CDC0_INTFNUM,100);
 			} else {
 				error("READ");
@@ -496,7 +623,13 @@ void do_usb_command(uint8_t* cmdbuf, uint16_t len) {
 		uint8_t idx = 1;
 		uint16_t block = parseDec(cmdbuf, &idx, len);
 		nand_block_erase(block);
+		if (block == 0) otp_load_metadata();
 		cdcSendDataWaitTilDone((BYTE*)"OK\n", 3, CDC0_INTFNUM, 100);
+	} else if (cmdbuf[0] == 'B') {
+		// Measure bus throughput. Parameter is a decimal scratch block number.
+		uint8_t idx = 1;
+		uint16_t block = parseDec(cmdbuf, &idx, len);
+		print_throughput(block);
 #endif
 	} else {
 		cmdbuf[len] = '\0';
@@ -3,7 +3,13 @@
 #include <msp430f5508.h>
 #include <stdbool.h>
 #include "ecc.h"
+#include "bch.h"
+#include "crc32.h"
 #include "buffers.h"
+#include "timer.h"
+#ifdef NAND_DMA
+#include "driverlib.h"
+#endif
 
 /**
  * Pin assignments
@@ -25,6 +31,92 @@
 #define WPP_BIT BIT0
 #define RB_BIT BIT7
 
+/** Strobe edges for the address and data cycles. Each is a single bic.b or
+	bis.b on P4OUT, where the nand_set_* helpers below read and rewrite the
+	port through a branch. */
+#define WE_LOW() (P4OUT &= ~WEP_BIT)
+#define WE_HIGH() (P4OUT |= WEP_BIT)
+#define RE_LOW() (P4OUT &= ~REP_BIT)
+#define RE_HIGH() (P4OUT |= REP_BIT)
+
+#ifdef NAND_DMA
+/**
+ * DMA transfers
+ *
+ * Timer_B0 generates the RE#/WE# strobes: CCR1 is port mapped onto both
+ * P4.1 and P4.6, and a transfer hands one of them to the timer through
+ * P4SEL. Each period the strobe is low from the start of the count until
+ * CCR1. CCR2 triggers DMA channel 1, which moves one byte between P1 and
+ * the buffer: while RE# is low on reads, and after WE# has risen on writes
+ * (the byte for the next strobe). When channel 1 is done its DMAIFG triggers
+ * channel 2, which writes P4SEL back so that the strobe is held high by
+ * P4OUT before the next period begins.
+ *
+ * Channel 0 belongs to the USB stack (USB_DMA_CHAN). Its block copies would
+ * delay the strobe channel, but every USB send in this firmware waits until
+ * it is done, so they never overlap a NAND transfer.
+ *
+ * The strobe widths and the byte period come from a timing profile (see
+ * nand_set_timing), in SMCLK (20MHz) cycles.
+ */
+#define NAND_DMA_CHAN DMA_CHANNEL_1
+#define NAND_DMA_STOP_CHAN DMA_CHANNEL_2
+#define NAND_DMA_TRIGGER DMA_TRIGGERSOURCE_8       // TB0CCR2 CCIFG
+#define NAND_DMA_STOP_TRIGGER DMA_TRIGGERSOURCE_30 // DMA1IFG, for channel 2
+/** Shorter transfers (IDs, status, flags) are not worth setting up a DMA for. */
+#define NAND_DMA_MIN_COUNT 16
+#endif
+
+/**
+ * ONFI parameter page
+ *
+ * Byte offsets of the fields decoded by nand_read_geometry. Multi-byte fields
+ * are little endian. The chip returns three copies of the page back to back;
+ * each ends with a CRC-16 (polynomial 0x8005, seeded with 0x4F4E) over the
+ * bytes before it.
+ */
+#define ONFI_PARAM_SIZE 256
+#define ONFI_PARAM_COPIES 3
+#define ONFI_PAGE_SIZE 80        // 32 bits
+#define ONFI_SPARE_SIZE 84       // 16 bits
+#define ONFI_PAGES_PER_BLOCK 92  // 32 bits
+#define ONFI_BLOCKS_PER_LUN 96   // 32 bits
+#define ONFI_LUN_COUNT 100
+#define ONFI_PLANE_BITS 113      // low nybble: interleaved address bits
+#define ONFI_TIMING_MODES 129    // 16 bits
+#define ONFI_CRC 254             // 16 bits
+#define ONFI_CRC_SEED 0x4f4e
+#define ONFI_CRC_POLY 0x8005
+
+#ifdef NAND_STATS
+static NandStats stats;
+/** Data bytes sent since the last program setup (80h/81h), to tell full page
+	programs from partial ones. */
+static uint16_t program_bytes;
+#define NAND_STAT_IN(n) (stats.bytes_in += (n))
+#define NAND_STAT_OUT(n) (stats.bytes_out += (n), program_bytes += (n))
+#define NAND_STAT_CORRECTED(n) (stats.corrected_bits += (n))
+#define NAND_STAT_FAILED() (stats.ecc_failures++)
+#else
+#define NAND_STAT_IN(n)
+#define NAND_STAT_OUT(n)
+#define NAND_STAT_CORRECTED(n)
+#define NAND_STAT_FAILED()
+#endif
+
+/** The compiled default geometry, used until (and unless) the chip reports its own. */
+NandGeometry nand_geometry = {
+	SPARE_START,
+	PARA_SPARE_SIZE * 4,
+	PAGE_COUNT,
+	1 << BLOCK_BITS,
+	1 << (BLOCK_BITS - PLANE_BITS),
+	BLOCK_BITS,
+	PLANE_COUNT,
+	0x0001,
+	false
+};
+
 /** Output to NAND data bus.
  *  @param value 8-bit value to write to bus.
  */
@@ -53,6 +145,122 @@ inline void nand_set_reP(bool high) { P4OUT=high?(P4OUT | REP_BIT):(P4OUT & ~REP
 inline void nand_set_weP(bool high) { P4OUT=high?(P4OUT | WEP_BIT):(P4OUT & ~WEP_BIT); }
 inline void nand_set_wpP(bool high) { P4OUT=high?(P4OUT | WPP_BIT):(P4OUT & ~WPP_BIT); }
 
+#ifdef NAND_DMA
+/** P4SEL with the strobes returned to P4OUT; channel 2 writes this to end a transfer. */
+static uint8_t strobe_idle_sel;
+/** Source for nand_send_zeros. */
+static const uint8_t zero_byte = 0;
+/**
+ * Timing profiles, indexed by NandTimingProfile.
+ *
+ * A period must leave room after the last transfer of channel 1 for the stop
+ * channel to write P4SEL before the timer starts another strobe; each DMA
+ * transfer takes up to four cycles with the trigger synchronization.
+ */
+static const NandTiming timing_profiles[] = {
+	// ONFI mode 0 (tRC/tWC 100ns): the original margins
+	{ 16, 8, 1, 4, 5 },
+	// ONFI mode 1 and up (tRC/tWC 50ns, tREA 30ns): tREA is still well inside
+	// the first cycle; the period is set by the DMA
+	{ 12, 6, 1, 2, 3 },
+};
+
+/** The profile in use. */
+static const NandTiming* timing = &timing_profiles[NAND_TIMING_MODE0];
+
+void nand_set_timing(NandTimingProfile profile) {
+	timing = &timing_profiles[profile];
+}
+
+NandTimingProfile nand_get_timing() {
+	return (NandTimingProfile)(timing - timing_profiles);
+}
+
+/** Length of the transfer in progress, for nand_dma_progress. */
+static uint16_t dma_count;
+
+/**
+ * Map the strobes onto Timer_B0 and set up the two DMA channels.
+ */
+static void nand_dma_init() {
+	PMAPPWD = PMAPKEY;
+	P4MAP1 = PM_TB0CCR1A;
+	P4MAP6 = PM_TB0CCR1A;
+	PMAPPWD = 0;
+
+	DMA_init(DMA_BASE, NAND_DMA_CHAN, DMA_TRANSFER_SINGLE, 0,
+		NAND_DMA_TRIGGER, DMA_SIZE_SRCBYTE_DSTBYTE, DMA_TRIGGER_RISINGEDGE);
+	DMA_init(DMA_BASE, NAND_DMA_STOP_CHAN, DMA_TRANSFER_SINGLE, 1,
+		NAND_DMA_STOP_TRIGGER, DMA_SIZE_SRCBYTE_DSTBYTE, DMA_TRIGGER_RISINGEDGE);
+	DMA_setSrcAddress(DMA_BASE, NAND_DMA_STOP_CHAN, (uint32_t)&strobe_idle_sel, DMA_DIRECTION_UNCHANGED);
+	DMA_setDstAddress(DMA_BASE, NAND_DMA_STOP_CHAN, (uint32_t)&P4SEL, DMA_DIRECTION_UNCHANGED);
+}
+
+/**
+ * Start a strobed transfer between the NAND bus and memory. The control lines
+ * and bus direction must already be set up for the data phase.
+ * @param out true to send to the NAND, false to receive
+ * @param buffer the memory side of the transfer
+ * @param count the number of bytes to move
+ * @param increment false to send the same byte count times
+ */
+static void nand_dma_start(bool out, const uint8_t* buffer, uint16_t count, bool increment) {
+	if (out) {
+		NAND_STAT_OUT(count);
+	} else {
+		NAND_STAT_IN(count);
+	}
+	uint8_t strobe = out?WEP_BIT:REP_BIT;
+	TB0CTL = TBSSEL_2 | MC_0 | TBCLR;
+	TB0CCR0 = timing->period - 1;
+	TB0CCR1 = out?timing->we_low:timing->re_low;
+	TB0CCR2 = out?timing->we_load:timing->re_sample;
+	TB0CCTL1 = OUTMOD_0;	// strobe low until the first CCR1
+	TB0CCTL1 = OUTMOD_3;	// then set at CCR1, reset at CCR0
+	TB0CCTL2 = 0;
+	if (out) {
+		// The first byte goes out with the first strobe; each transfer then
+		// loads the byte for the following strobe, so the last one reads a
+		// byte past the end of the buffer that is never clocked out.
+		P1OUT = buffer[0];
+		DMA_setSrcAddress(DMA_BASE, NAND_DMA_CHAN, (uint32_t)(buffer + (increment?1:0)),
+			increment?DMA_DIRECTION_INCREMENT:DMA_DIRECTION_UNCHANGED);
+		DMA_setDstAddress(DMA_BASE, NAND_DMA_CHAN, (uint32_t)&P1OUT, DMA_DIRECTION_UNCHANGED);
+	} else {
+		DMA_setSrcAddress(DMA_BASE, NAND_DMA_CHAN, (uint32_t)&P1IN, DMA_DIRECTION_UNCHANGED);
+		DMA_setDstAddress(DMA_BASE, NAND_DMA_CHAN, (uint32_t)buffer, DMA_DIRECTION_INCREMENT);
+	}
+	dma_count = count;
+	DMA_setTransferSize(DMA_BASE, NAND_DMA_CHAN, count);
+	DMA_clearInterrupt(DMA_BASE, NAND_DMA_CHAN);
+	DMA_clearInterrupt(DMA_BASE, NAND_DMA_STOP_CHAN);
+	DMA_enableTransfers(DMA_BASE, NAND_DMA_STOP_CHAN);
+	DMA_enableTransfers(DMA_BASE, NAND_DMA_CHAN);
+	strobe_idle_sel = P4SEL & ~(WEP_BIT | REP_BIT);
+	P4SEL |= strobe;
+	TB0CTL = TBSSEL_2 | MC_1;
+}
+
+/**
+ * Get the number of bytes the transfer in progress has moved so far.
+ */
+static uint16_t nand_dma_progress() {
+	// DMAxSZ counts down, and is reloaded when DMAEN drops at the end
+	if ((HWREG16(DMA_BASE + NAND_DMA_CHAN + OFS_DMA0CTL) & DMAEN) == 0) return dma_count;
+	return dma_count - HWREG16(DMA_BASE + NAND_DMA_CHAN + OFS_DMA0SZ);
+}
+
+/**
+ * Wait for the transfer in progress to end and stop the strobe timer.
+ */
+static void nand_dma_finish() {
+	while (DMA_getInterruptStatus(DMA_BASE, NAND_DMA_STOP_CHAN) == DMA_INT_INACTIVE) ;
+	TB0CTL = TBSSEL_2 | MC_0;
+}
+#endif
+
+static void nand_ready_init();
+
 /**
  * Initialize all the pins required to interact with the NAND
  * flash.
@@ -79,6 +287,18 @@ void nand_init() {
 	nand_set_wpP(true);
 	// Default chip enable true
 	nand_set_ceP(false);
+
+	nand_ready_init();
+
+#ifdef NAND_DMA
+	nand_dma_init();
+#endif
+
+	nand_read_geometry();
+#if defined(NAND_DMA) && defined(NAND_FAST_TIMING)
+	// bit 0 is mode 0, which every ONFI part supports
+	nand_set_timing((nand_geometry.timing_modes & ~0x0001)?NAND_TIMING_FAST:NAND_TIMING_MODE0);
+#endif
 }
 
 
@@ -88,88 +308,376 @@ inline bool nand_check_rb() {
 	return (P4IN & RB_BIT) != 0;
 }
 
+/**
+ * Ready interrupt
+ *
+ * Port 4 has no pin interrupts on this part, so R/B# is port mapped onto the
+ * capture input of Timer_B0 CCR3 instead; a capture on the rising edge (the
+ * end of an array operation) raises the interrupt. Capture does not need the
+ * timer to be counting, so this is unaffected by the strobe timer stopping
+ * and starting.
+ */
+static volatile NandReadyHandler ready_handler = 0;
+
+static void nand_ready_init() {
+	PMAPPWD = PMAPKEY;
+	P4MAP7 = PM_TB0CCR3A;
+	PMAPPWD = 0;
+	P4SEL |= RB_BIT;
+	TB0CCTL3 = CM_1 | CCIS_0 | CAP | CCIE;
+}
+
+bool nand_is_ready() {
+	return nand_check_rb();
+}
+
+void nand_set_ready_handler(NandReadyHandler handler) {
+	ready_handler = handler;
+}
+
 void nand_wait_for_ready() {
-	while (!nand_check_rb()) ;
+#ifdef NAND_STATS
+	uint16_t start;
+	if (nand_check_rb()) return;
+	stats.busy_waits++;
+	start = timer_usec();
+#endif
+	if ((__get_SR_register() & GIE) == 0) {
+		// no interrupts to wake us; just spin
+		while (!nand_check_rb()) ;
+	} else {
+		// Test and sleep with interrupts off, so that an edge between the two
+		// can't be missed; entering LPM0 re-enables them atomically.
+		__disable_interrupt();
+		while (!nand_check_rb()) {
+			__bis_SR_register(LPM0_bits | GIE);
+			__disable_interrupt();
+		}
+		__enable_interrupt();
+	}
+#ifdef NAND_STATS
+	stats.busy_usec += (uint16_t)(timer_usec() - start);
+#endif
+}
+
+#pragma vector=TIMER0_B1_VECTOR
+__interrupt void nand_ready_isr(void) {
+	switch (__even_in_range(TB0IV,14)) {
+	case TB0IV_TB0CCR3:
+		if (ready_handler) ready_handler();
+		__bic_SR_register_on_exit(LPM0_bits);
+		break;
+	default:
+		break;
+	}
 }
 
 void nand_send_command(uint8_t cmd) {
+#ifdef NAND_STATS
+	switch (cmd) {
+	case 0x30: // read
+	case 0x31: // cache read, which also reads the next page
+		stats.array_reads++;
+		break;
+	case 0x60: // erase setup, once for each plane
+		stats.erases++;
+		break;
+	case 0x80: // program setup
+	case 0x81: // program setup for the second plane
+		program_bytes = 0;
+		break;
+	case 0x10: // program
+	case 0x11: // program first plane of a pair
+	case 0x15: // cache program
+		if (program_bytes >= nand_geometry.page_size) {
+			stats.page_programs++;
+		} else {
+			stats.partial_programs++;
+		}
+		break;
+	default:
+		break;
+	}
+#endif
 	nand_set_cle(true); nand_set_ale(false); nand_set_weP(false); nand_set_reP(true);
 	nand_io_write(cmd);
 	nand_io_dir(true);
-	nand_set_weP(true);
+	WE_HIGH();
 }
 
 void nand_send_address(uint32_t addr) {
 	nand_set_cle(false); nand_set_ale(true); nand_set_weP(false); nand_set_reP(true);
 	P1OUT = addr & 0xff;
-	nand_set_weP(true);
+	WE_HIGH();
 
-	nand_set_weP(false);
+	WE_LOW();
 	P1OUT = (addr >> 8) & 0x0f;
-	nand_set_weP(true);
+	WE_HIGH();
 
-	nand_set_weP(false);
+	WE_LOW();
 	P1OUT = (addr >> 12) & 0xff;
-	nand_set_weP(true);
+	WE_HIGH();
 
-	nand_set_weP(false);
+	WE_LOW();
 	P1OUT = (addr >> 20) & 0xff;
-	nand_set_weP(true);
+	WE_HIGH();
 
-	nand_set_weP(false);
+	WE_LOW();
 	P1OUT = (addr >> 28) & 0x0f;
-	nand_set_weP(true);
+	WE_HIGH();
 }
 
 void nand_send_row_address(uint32_t addr) {
 	nand_set_cle(false); nand_set_ale(true); nand_set_weP(false); nand_set_reP(true);
 	P1OUT = (addr >> 12) & 0xff;
-	nand_set_weP(true);
+	WE_HIGH();
 
-	nand_set_weP(false);
+	WE_LOW();
 	P1OUT = (addr >> 20) & 0xff;
-	nand_set_weP(true);
+	WE_HIGH();
 
-	nand_set_weP(false);
+	WE_LOW();
 	P1OUT = (addr >> 28) & 0x0f;
-	nand_set_weP(true);
+	WE_HIGH();
+}
+
+void nand_send_column_address(uint16_t column) {
+	nand_set_cle(false); nand_set_ale(true); nand_set_weP(false); nand_set_reP(true);
+	P1OUT = column & 0xff;
+	WE_HIGH();
+
+	WE_LOW();
+	P1OUT = (column >> 8) & 0x0f;
+	WE_HIGH();
 }
 
 void nand_send_byte_address(uint8_t baddr) {
 	nand_set_cle(false); nand_set_ale(true); nand_set_weP(false); nand_set_reP(true);
 	P1OUT = baddr;
-	nand_set_weP(true);
+	WE_HIGH();
 }
 
 void nand_recv_data(uint8_t* buffer, uint16_t count) {
 	nand_set_cle(false); nand_set_ale(false); nand_set_weP(true); nand_set_reP(true);
 	nand_io_dir(false);
-	while (count--) {
-		nand_set_reP(false);
+#ifdef NAND_DMA
+	if (count >= NAND_DMA_MIN_COUNT) {
+		nand_dma_start(false,buffer,count,true);
+		nand_dma_finish();
+		return;
+	}
+#endif
+	NAND_STAT_IN(count);
+	// two bytes a pass, so the loop overhead is paid once per pair
+	if (count & 1) {
+		RE_LOW();
 		*(buffer++) = P1IN;
-		nand_set_reP(true);
+		RE_HIGH();
+	}
+	count >>= 1;
+	while (count--) {
+		RE_LOW();
+		buffer[0] = P1IN;
+		RE_HIGH();
+		RE_LOW();
+		buffer[1] = P1IN;
+		RE_HIGH();
+		buffer += 2;
 	}
 }
 
 void nand_send_data(const uint8_t* buffer, uint16_t count) {
+#ifdef NAND_DMA
+	if (count >= NAND_DMA_MIN_COUNT) {
+		nand_set_cle(false); nand_set_ale(false); nand_set_weP(true); nand_set_reP(true);
+		nand_io_dir(true);
+		nand_dma_start(true,buffer,count,true);
+		nand_dma_finish();
+		return;
+	}
+#endif
 	nand_set_cle(false); nand_set_ale(false); nand_set_weP(false); nand_set_reP(true);
 	nand_io_write(0);
 	nand_io_dir(true);
+	NAND_STAT_OUT(count);
+	// two bytes a pass, so the loop overhead is paid once per pair
+	if (count & 1) {
+		WE_LOW();
+		P1OUT = *(buffer++);
+		WE_HIGH();
+	}
+	count >>= 1;
 	while (count--) {
-		nand_set_weP(false);
-		nand_io_write(*(buffer++));
-		nand_set_weP(true);
+		WE_LOW();
+		P1OUT = buffer[0];
+		WE_HIGH();
+		WE_LOW();
+		P1OUT = buffer[1];
+		WE_HIGH();
+		buffer += 2;
+	}
+}
+
+/**
+ * Receive a 512B paragraph and its spare area, building the SEC-DED code of
+ * the data as each byte comes in so that the buffer doesn't need a second
+ * pass to be verified.
+ * @param buffer the buffer to fill with PARA_SIZE+PARA_SPARE_SIZE bytes
+ * @return the ECC computed over the received data
+ */
+static uint32_t nand_recv_para_ecc(uint8_t* buffer) {
+	EccState ecc;
+	uint16_t idx;
+	ecc_begin(&ecc);
+	nand_set_cle(false); nand_set_ale(false); nand_set_weP(true); nand_set_reP(true);
+	nand_io_dir(false);
+#ifdef NAND_DMA
+	// follow the DMA through the buffer
+	nand_dma_start(false,buffer,PARA_SIZE+PARA_SPARE_SIZE,true);
+	idx = 0;
+	while (idx < PARA_SIZE) {
+		uint16_t done = nand_dma_progress();
+		for (; idx < done && idx < PARA_SIZE; idx++) {
+			ecc_update(&ecc,idx,((volatile uint8_t*)buffer)[idx]);
+		}
+	}
+	nand_dma_finish();
+#else
+	NAND_STAT_IN(PARA_SIZE);
+	for (idx = 0; idx < PARA_SIZE; idx++) {
+		uint8_t c;
+		RE_LOW();
+		c = P1IN;
+		RE_HIGH();
+		buffer[idx] = c;
+		ecc_update(&ecc,idx,c);
 	}
+	nand_recv_data(buffer + PARA_SIZE, PARA_SPARE_SIZE);
+#endif
+	return ecc_finish(&ecc);
+}
+
+/**
+ * Send a 512B paragraph, building its SEC-DED code as each byte is strobed
+ * out so that the buffer doesn't need a separate pass before programming.
+ * @param buffer the PARA_SIZE bytes to send
+ * @return the ECC computed over the sent data
+ */
+static uint32_t nand_send_para_ecc(const uint8_t* buffer) {
+	EccState ecc;
+	uint16_t idx;
+	ecc_begin(&ecc);
+#ifdef NAND_DMA
+	nand_set_cle(false); nand_set_ale(false); nand_set_weP(true); nand_set_reP(true);
+	nand_io_dir(true);
+	nand_dma_start(true,buffer,PARA_SIZE,true);
+	for (idx = 0; idx < PARA_SIZE; idx++) ecc_update(&ecc,idx,buffer[idx]);
+	nand_dma_finish();
+#else
+	nand_set_cle(false); nand_set_ale(false); nand_set_weP(false); nand_set_reP(true);
+	nand_io_write(0);
+	nand_io_dir(true);
+	NAND_STAT_OUT(PARA_SIZE);
+	for (idx = 0; idx < PARA_SIZE; idx++) {
+		uint8_t c = buffer[idx];
+		WE_LOW();
+		P1OUT = c;
+		WE_HIGH();
+		ecc_update(&ecc,idx,c);
+	}
+#endif
+	return ecc_finish(&ecc);
+}
+
+/**
+ * Receive a 512B paragraph and its spare area, building the BCH code of the
+ * data as each byte comes in.
+ * @param buffer the buffer to fill with PARA_SIZE+PARA_SPARE_SIZE bytes
+ * @param code the BCH_ECC_BYTES bytes to receive the code computed over the data
+ */
+static void nand_recv_para_bch(uint8_t* buffer, uint8_t* code) {
+	BchState bch;
+	uint16_t idx;
+	uint8_t i;
+	bch_begin(&bch);
+	nand_set_cle(false); nand_set_ale(false); nand_set_weP(true); nand_set_reP(true);
+	nand_io_dir(false);
+#ifdef NAND_DMA
+	// follow the DMA through the buffer
+	nand_dma_start(false,buffer,PARA_SIZE+PARA_SPARE_SIZE,true);
+	idx = 0;
+	while (idx < PARA_SIZE) {
+		uint16_t done = nand_dma_progress();
+		for (; idx < done && idx < PARA_SIZE; idx++) {
+			bch_update(&bch,((volatile uint8_t*)buffer)[idx]);
+		}
+	}
+	nand_dma_finish();
+#else
+	NAND_STAT_IN(PARA_SIZE);
+	for (idx = 0; idx < PARA_SIZE; idx++) {
+		uint8_t c;
+		RE_LOW();
+		c = P1IN;
+		RE_HIGH();
+		buffer[idx] = c;
+		bch_update(&bch,c);
+	}
+	nand_recv_data(buffer + PARA_SIZE, PARA_SPARE_SIZE);
+#endif
+	for (i = 0; i < BCH_ECC_BYTES; i++) code[i] = bch.r[i];
+}
+
+/**
+ * Send a 512B paragraph, building its BCH code as each byte is strobed out.
+ * @param buffer the PARA_SIZE bytes to send
+ * @param code the BCH_ECC_BYTES bytes to receive the code computed over the data
+ */
+static void nand_send_para_bch(const uint8_t* buffer, uint8_t* code) {
+	BchState bch;
+	uint16_t idx;
+	uint8_t i;
+	bch_begin(&bch);
+#ifdef NAND_DMA
+	nand_set_cle(false); nand_set_ale(false); nand_set_weP(true); nand_set_reP(true);
+	nand_io_dir(true);
+	nand_dma_start(true,buffer,PARA_SIZE,true);
+	for (idx = 0; idx < PARA_SIZE; idx++) bch_update(&bch,buffer[idx]);
+	nand_dma_finish();
+#else
+	nand_set_cle(false); nand_set_ale(false); nand_set_weP(false); nand_set_reP(true);
+	nand_io_write(0);
+	nand_io_dir(true);
+	NAND_STAT_OUT(PARA_SIZE);
+	for (idx = 0; idx < PARA_SIZE; idx++) {
+		uint8_t c = buffer[idx];
+		WE_LOW();
+		P1OUT = c;
+		WE_HIGH();
+		bch_update(&bch,c);
+	}
+#endif
+	for (i = 0; i < BCH_ECC_BYTES; i++) code[i] = bch.r[i];
 }
 
 void nand_send_zeros(uint16_t count) {
+#ifdef NAND_DMA
+	if (count >= NAND_DMA_MIN_COUNT) {
+		nand_set_cle(false); nand_set_ale(false); nand_set_weP(true); nand_set_reP(true);
+		nand_io_dir(true);
+		nand_dma_start(true,&zero_byte,count,false);
+		nand_dma_finish();
+		return;
+	}
+#endif
 	nand_set_cle(false); nand_set_ale(false); nand_set_weP(false); nand_set_reP(true);
 	nand_io_write(0);
 	nand_io_dir(true);
+	NAND_STAT_OUT(count);
+	// the bus holds zero throughout; only WE# needs to move
 	while (count--) {
-		nand_set_weP(false);
-		nand_io_write(0);
-		nand_set_weP(true);
+		WE_LOW();
+		WE_HIGH();
 	}
 }
 
@@ -199,10 +707,27 @@ uint8_t nand_read_status_reg() {
 	return buf;
 }
 
+void nand_submit_erase(uint16_t block) {
+	nand_send_command(0x60);
+	nand_send_row_address(nand_make_para_addr(block,0,0));
+	nand_send_command(0xd0);
+}
+
 void nand_block_erase(uint16_t block) {
+	nand_submit_erase(block);
+	nand_wait_for_ready();
+}
+
+void nand_submit_erase_planes(uint16_t block) {
 	nand_send_command(0x60);
 	nand_send_row_address(nand_make_para_addr(block,0,0));
+	nand_send_command(0x60);
+	nand_send_row_address(nand_make_para_addr(block + nand_geometry.plane_blocks,0,0));
 	nand_send_command(0xd0);
+}
+
+void nand_block_erase_planes(uint16_t block) {
+	nand_submit_erase_planes(block);
 	nand_wait_for_ready();
 }
 
@@ -225,9 +750,76 @@ bool nand_program_raw_page(const uint32_t address, const uint8_t* buffer, const
 void nand_read_parameter_page(uint8_t* buffer, uint16_t count) {
 	nand_send_command(0xec);
 	nand_send_address(0x00);
+	nand_wait_for_ready();
 	nand_recv_data(buffer, count);
 }
 
+static uint16_t onfi_crc(const uint8_t* data, uint16_t count) {
+	uint16_t crc = ONFI_CRC_SEED;
+	uint8_t bit;
+	while (count--) {
+		crc ^= ((uint16_t)*(data++)) << 8;
+		for (bit = 0; bit < 8; bit++) {
+			crc = (crc & 0x8000)?((crc << 1) ^ ONFI_CRC_POLY):(crc << 1);
+		}
+	}
+	return crc;
+}
+
+static uint16_t onfi_u16(const uint8_t* field) {
+	return field[0] | ((uint16_t)field[1] << 8);
+}
+
+static uint32_t onfi_u32(const uint8_t* field) {
+	return onfi_u16(field) | ((uint32_t)onfi_u16(field + 2) << 16);
+}
+
+bool nand_read_geometry() {
+	// nothing else uses the paragraph buffer this early
+	uint8_t* param = buffers_get_nand();
+	uint8_t copy;
+	uint8_t bits;
+	uint32_t blocks;
+	if (!nand_check_ONFI()) return false;
+	for (copy = 0; copy < ONFI_PARAM_COPIES; copy++) {
+		if (copy == 0) {
+			nand_read_parameter_page(param, ONFI_PARAM_SIZE);
+		} else {
+			// the redundant copies follow on from the first
+			nand_recv_data(param, ONFI_PARAM_SIZE);
+		}
+		if (param[0] == 'O' && param[1] == 'N' && param[2] == 'F' && param[3] == 'I' &&
+				onfi_crc(param, ONFI_CRC) == onfi_u16(param + ONFI_CRC)) {
+			break;
+		}
+	}
+	if (copy == ONFI_PARAM_COPIES) return false;
+	// The page layout, plane pairing and single LUN addressing are compiled in;
+	// only the number of blocks may differ.
+	if (onfi_u32(param + ONFI_PAGE_SIZE) != SPARE_START ||
+			onfi_u16(param + ONFI_SPARE_SIZE) < PARA_SPARE_SIZE * 4 ||
+			onfi_u32(param + ONFI_PAGES_PER_BLOCK) != PAGE_COUNT ||
+			(param[ONFI_PLANE_BITS] & 0x0f) != PLANE_BITS ||
+			param[ONFI_LUN_COUNT] != 1) {
+		return false;
+	}
+	blocks = onfi_u32(param + ONFI_BLOCKS_PER_LUN);
+	for (bits = PLANE_BITS + 1; bits <= MAX_BLOCK_BITS; bits++) {
+		if (blocks == (1L << bits)) break;
+	}
+	if (bits > MAX_BLOCK_BITS) return false;
+	nand_geometry.page_size = SPARE_START;
+	nand_geometry.spare_size = onfi_u16(param + ONFI_SPARE_SIZE);
+	nand_geometry.pages_per_block = PAGE_COUNT;
+	nand_geometry.block_count = blocks;
+	nand_geometry.plane_blocks = blocks >> PLANE_BITS;
+	nand_geometry.block_bits = bits;
+	nand_geometry.plane_count = PLANE_COUNT;
+	nand_geometry.timing_modes = onfi_u16(param + ONFI_TIMING_MODES);
+	nand_geometry.onfi = true;
+	return true;
+}
+
 /**
  * ***** WRONG ********
  * Data+spare buffer. This is arranged as follows:
@@ -243,6 +835,21 @@ void nand_read_parameter_page(uint8_t* buffer, uint16_t count) {
  */
 
 
+static NandEccMode ecc_mode = NAND_ECC_SECDED;
+static uint8_t corrected_bits = 0;
+
+void nand_set_ecc_mode(NandEccMode mode) {
+	ecc_mode = mode;
+}
+
+NandEccMode nand_get_ecc_mode() {
+	return ecc_mode;
+}
+
+uint8_t nand_para_corrected_bits() {
+	return corrected_bits;
+}
+
 /**
  * Initialize the page buffer with unprogrammed (0xff) values.
  */
@@ -252,61 +859,232 @@ void nand_initialize_para_buffer() {
 	for (idx = 0; idx < PARA_SIZE + PARA_SPARE_SIZE; idx++) para_buffer[idx] = 0xff;
 }
 
+static bool nand_recv_para_checked();
+static void nand_send_para_coded();
+
 /**
- * Load an entire paragraph into the paragraph buffer. Uses a Huffman code for SEC-DED on each 512B paragraph.
+ * Load an entire paragraph into the paragraph buffer. Each 512B paragraph is checked and corrected with
+ * the code selected by nand_set_ecc_mode.
  * @param block the block index
  * @param page the page number
  * @param paragraph the paragraph within the page to zero (0-3).
- * @return true if the read was successful; false if there was a multibit error.
+ * @return true if the read was successful; false if there were more errors than the code can correct.
  */
 bool nand_load_para(uint16_t block, uint8_t page, uint8_t paragraph) {
+	nand_submit_read_para(block,page,paragraph);
+	nand_wait_for_ready();
+	return nand_collect_para();
+}
+
+void nand_submit_read_para(uint16_t block, uint8_t page, uint8_t paragraph) {
 	uint32_t address = nand_make_para_addr(block,page,paragraph);
+	nand_send_command(0x00);
+	nand_send_address(address);
+	nand_send_command(0x30);
+}
+
+bool nand_collect_para() {
+	return nand_recv_para_checked();
+}
+
+void nand_load_page(uint16_t block, uint8_t page) {
+	nand_submit_read_para(block,page,0);
+	nand_wait_for_ready();
+}
+
+bool nand_page_para(uint8_t paragraph) {
+	// random data output: move to the paragraph's column in the data register
+	nand_send_command(0x05);
+	nand_send_column_address(paragraph*(PARA_SIZE+PARA_SPARE_SIZE));
+	nand_send_command(0xe0);
+	return nand_recv_para_checked();
+}
+
+/**
+ * Receive the paragraph at the current column into the paragraph buffer, and
+ * check and correct it with the code selected by nand_set_ecc_mode.
+ * @return true if the read was successful; false if there were more errors than the code can correct.
+ */
+static bool nand_recv_para_checked() {
 	uint8_t* para_buffer = buffers_get_nand();
-	nand_read_raw_page(address, para_buffer, PARA_SIZE+PARA_SPARE_SIZE);
-	uint32_t ecc = *(uint32_t*)(para_buffer + PARA_SIZE);
-	if (!ecc_verify(para_buffer,ecc)) return false;
+	corrected_bits = 0;
+	if (ecc_mode == NAND_ECC_BCH) {
+		uint8_t code[BCH_ECC_BYTES];
+		int8_t fixed;
+		nand_recv_para_bch(para_buffer,code);
+		fixed = bch_correct(para_buffer,code,para_buffer + PARA_SIZE);
+		if (fixed < 0) {
+			NAND_STAT_FAILED();
+			return false;
+		}
+		corrected_bits = fixed;
+	} else {
+		uint32_t ecc, stored;
+		int8_t fixed;
+		ecc = nand_recv_para_ecc(para_buffer);
+		stored = *(uint32_t*)(para_buffer + PARA_SIZE);
+		fixed = ecc_correct(para_buffer,ecc,stored);
+		if (fixed < 0) {
+			NAND_STAT_FAILED();
+			return false;
+		}
+		corrected_bits = fixed;
+	}
+	NAND_STAT_CORRECTED(corrected_bits);
 	return true;
 }
 
 /**
  * Compute the trivial checksum of a block.
  * @block the index of the block to generate a checksum for
- * @return the computed checksum
+ * @return the computed checksum, a flag indicating any errors, and the number
+ * of bits corrected while reading the block
  */
 struct checksum_ret nand_block_checksum(uint16_t block) {
-	struct checksum_ret rv = {0,true};
-	uint8_t page, para;
+	struct checksum_ret rv = {CRC32_INIT,true,0};
+	uint16_t para;
 	uint8_t* para_buffer = buffers_get_nand();
-	for (page = 0; page < PAGE_COUNT; page++) {
-		for (para = 0; para < 4; para++) {
-			if (nand_load_para(block,page,para)) {
-				uint16_t idx;
-				for (idx = 0; idx < 512; idx++) {
-					rv.checksum += para_buffer[idx];
-				}
-			} else {
-				rv.ok = false;
-			}
+	nand_stream_begin(block,0);
+	for (para = 0; para < PAGE_COUNT*4; para++) {
+		if (nand_stream_next_para()) {
+			rv.corrected += corrected_bits;
+			rv.crc = crc32_update(rv.crc, para_buffer, PARA_SIZE);
+		} else {
+			rv.ok = false;
 		}
 	}
+	nand_stream_end();
+	rv.crc = crc32_finish(rv.crc);
 	return rv;
 }
 
+/**
+ * Sequential cache read state. After the initial 00h/30h both the data and
+ * cache registers hold the first page. Each 31h moves the page in the data
+ * register to the cache register for output and starts loading the next
+ * page behind it; 3Fh does the same without loading another page, and takes
+ * the chip out of cache read mode.
+ */
+static uint8_t stream_page;
+static uint8_t stream_para;
+static bool stream_loading; // a 31h has the page after stream_page loading
+
+void nand_stream_begin(uint16_t block, uint8_t page) {
+	stream_page = page;
+	stream_para = 0;
+	stream_loading = false;
+	nand_send_command(0x00);
+	nand_send_address(nand_make_para_addr(block,page,0));
+	nand_send_command(0x30);
+	nand_wait_for_ready();
+}
+
+bool nand_stream_next_para() {
+	bool ok;
+	if (stream_para == 0) {
+		stream_loading = stream_page < PAGE_COUNT - 1;
+		nand_send_command(stream_loading?0x31:0x3f);
+		nand_wait_for_ready();
+	}
+	ok = nand_recv_para_checked();
+	if (++stream_para == 4) {
+		stream_para = 0;
+		stream_page++;
+	}
+	return ok;
+}
+
+void nand_stream_end() {
+	if (stream_loading) {
+		// collect the page that is still loading so the chip leaves cache mode
+		nand_send_command(0x3f);
+		nand_wait_for_ready();
+		stream_loading = false;
+	}
+}
+
 
 /**
- * Write an entire page from the page buffer into NAND with SEC-DED error correction.
- * At present, blocks until entire page write is complete.
+ * Write an entire page from the page buffer into NAND with the code selected by nand_set_ecc_mode.
+ * Returns once the data is loaded; the program itself completes in the background
+ * (see nand_wait_for_ready).
  * @param block the block index
  * @param page the page number
  * @param paragraph the paragraph within the page to zero (0-3).
  * @return true if the write was successful; false if there was a write error.
  */
 bool nand_save_para(uint16_t block, uint8_t page, uint8_t paragraph) {
+	nand_submit_program_para(block,page,paragraph);
+	return true;
+}
+
+void nand_submit_program_para(uint16_t block, uint8_t page, uint8_t paragraph) {
 	uint32_t address = nand_make_para_addr(block,page,paragraph);
+	nand_send_command(0x80);
+	nand_send_address(address);
+	nand_send_para_coded();
+	nand_send_command(0x10);
+}
+
+bool nand_cache_para(uint16_t block, uint8_t page, uint8_t paragraph) {
+	if (paragraph == 0) {
+		// wait for the cache register to be free of the previous page
+		nand_wait_for_ready();
+		nand_send_command(0x80);
+		nand_send_address(nand_make_para_addr(block,page,0));
+	} else {
+		nand_send_command(0x85);
+		nand_send_column_address(paragraph*(PARA_SIZE+PARA_SPARE_SIZE));
+	}
+	nand_send_para_coded();
+	if (paragraph == 3) {
+		// cache program, except for the last page of the block
+		nand_send_command((page < PAGE_COUNT - 1)?0x15:0x10);
+	}
+	return true;
+}
+
+bool nand_cache_plane_para(uint16_t block, uint8_t page, uint8_t paragraph) {
+	bool first_plane = block < nand_geometry.plane_blocks;
+	if (paragraph == 0) {
+		if (first_plane) {
+			// wait for the cache register to be free of the previous page
+			nand_wait_for_ready();
+			nand_send_command(0x80);
+		} else {
+			nand_send_command(0x81);
+		}
+		nand_send_address(nand_make_para_addr(block,page,0));
+	} else {
+		nand_send_command(0x85);
+		nand_send_column_address(paragraph*(PARA_SIZE+PARA_SPARE_SIZE));
+	}
+	nand_send_para_coded();
+	if (paragraph == 3) {
+		if (first_plane) {
+			// queue this plane's page; the chip is only briefly busy (tDBSY)
+			nand_send_command(0x11);
+			nand_wait_for_ready();
+		} else {
+			nand_send_command((page < PAGE_COUNT - 1)?0x15:0x10);
+		}
+	}
+	return true;
+}
+
+/**
+ * Send the paragraph buffer at the current column, with the code selected by
+ * nand_set_ecc_mode placed at the start of its spare area.
+ */
+static void nand_send_para_coded() {
 	uint8_t* para_buffer = buffers_get_nand();
-	uint32_t ecc = ecc_generate(para_buffer);
-	*(uint32_t*)(para_buffer + PARA_SIZE) = ecc;
-	return nand_program_raw_page(address,para_buffer,PARA_SIZE+PARA_SPARE_SIZE);
+	// the code is complete by the time the data is out, and the spare follows it
+	if (ecc_mode == NAND_ECC_BCH) {
+		nand_send_para_bch(para_buffer,para_buffer + PARA_SIZE);
+	} else {
+		*(uint32_t*)(para_buffer + PARA_SIZE) = nand_send_para_ecc(para_buffer);
+	}
+	nand_send_data(para_buffer + PARA_SIZE, PARA_SPARE_SIZE);
 }
 
 /**
@@ -319,18 +1097,19 @@ uint8_t* nand_para_buffer() {
 }
 
 /**
- * Zero a 512B paragraph and its associated spare area. This should be done immediately
- * after using a paragraph.
+ * Zero consecutive 512B paragraphs of a page and their associated spare areas with a
+ * single program operation. This should be done immediately after using a paragraph.
  * @param block the block index
  * @param page the page number
- * @param paragraph the paragraph within the page to zero (0-3).
+ * @param paragraph the first paragraph within the page to zero (0-3).
+ * @param count the number of paragraphs to zero (1-4, not past the end of the page).
  * @return true if the zero was successful
  */
-bool nand_zero_paragraph(uint16_t block, uint8_t page, uint8_t paragraph) {
+bool nand_zero_paragraphs(uint16_t block, uint8_t page, uint8_t paragraph, uint8_t count) {
 	uint32_t address = nand_make_para_addr(block,page,paragraph);
 	nand_send_command(0x80);
 	nand_send_address(address);
-	nand_send_zeros(PARA_SIZE+PARA_SPARE_SIZE);
+	nand_send_zeros(count*(PARA_SIZE+PARA_SPARE_SIZE));
 	nand_send_command(0x10);
 
 	nand_wait_for_ready();
@@ -353,3 +1132,64 @@ bool nand_zero_page(uint32_t address) {
 
 	return true;
 }
+
+#ifdef NAND_STATS
+const NandStats* nand_get_stats() {
+	return &stats;
+}
+
+void nand_reset_stats() {
+	uint8_t i;
+	for (i = 0; i < sizeof(stats); i++) ((uint8_t*)&stats)[i] = 0;
+}
+#endif
+
+#ifdef DEBUG
+/** Pages programmed, read and zeroed by nand_measure_throughput. */
+#define THROUGHPUT_PAGES 8
+
+static uint16_t throughput(uint32_t bytes, uint32_t usec) {
+	return (usec == 0)?0:((bytes * 1000) / usec);
+}
+
+NandThroughput nand_measure_throughput(uint16_t block) {
+	NandThroughput rv;
+	uint8_t* buffer = buffers_get_nand();
+	const uint32_t bytes = (uint32_t)THROUGHPUT_PAGES * 4 * (PARA_SIZE + PARA_SPARE_SIZE);
+	uint32_t read_usec = 0, program_usec = 0, zero_usec = 0;
+	uint16_t start;
+	uint8_t page, para;
+	nand_block_erase(block);
+	for (page = 0; page < THROUGHPUT_PAGES; page++) {
+		nand_send_command(0x80);
+		nand_send_address(nand_make_addr(block,page,0));
+		start = timer_usec();
+		for (para = 0; para < 4; para++) nand_send_data(buffer, PARA_SIZE + PARA_SPARE_SIZE);
+		program_usec += (uint16_t)(timer_usec() - start);
+		nand_send_command(0x10);
+		nand_wait_for_ready();
+	}
+	for (page = 0; page < THROUGHPUT_PAGES; page++) {
+		nand_send_command(0x00);
+		nand_send_address(nand_make_addr(block,page,0));
+		nand_send_command(0x30);
+		nand_wait_for_ready();
+		start = timer_usec();
+		for (para = 0; para < 4; para++) nand_recv_data(buffer, PARA_SIZE + PARA_SPARE_SIZE);
+		read_usec += (uint16_t)(timer_usec() - start);
+	}
+	for (page = 0; page < THROUGHPUT_PAGES; page++) {
+		nand_send_command(0x80);
+		nand_send_address(nand_make_addr(block,page,0));
+		start = timer_usec();
+		nand_send_zeros(4 * (PARA_SIZE + PARA_SPARE_SIZE));
+		zero_usec += (uint16_t)(timer_usec() - start);
+		nand_send_command(0x10);
+		nand_wait_for_ready();
+	}
+	rv.read = throughput(bytes, read_usec);
+	rv.program = throughput(bytes, program_usec);
+	rv.zero = throughput(bytes, zero_usec);
+	return rv;
+}
+#endif
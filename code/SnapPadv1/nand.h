@@ -11,25 +11,89 @@
 #include <stdbool.h>
 #include "config.h"
 
-/** Specifies the number of blocks and pages available for the given chip.
+/** Specifies the geometry of the given chip as log2 values, so that every
+	address computation reduces to shifts and masks: BLOCK_BITS is the
+	log2 of the block count, PAGE_BITS the log2 of the pages per block,
+	PLANE_BITS the number of high block index bits that select the plane,
+	and COLUMN_BITS the width of the column address.
 	We no longer specify the planes explicitly; they are implied in the high
-	bit(s) of the block index. */
+	bit(s) of the block index.
+	The block count given here is only the default; the actual count is
+	read from the ONFI parameter page at boot (see NandGeometry), so that
+	larger parts of the same family, up to MAX_BLOCK_BITS, can be used. */
 #ifdef NAND_CHIP_S34ML01G2
-	#define BLOCK_COUNT 2048L
-	#define PAGE_COUNT 64
+	#define BLOCK_BITS 11			// 2048 blocks
+	#define MAX_BLOCK_BITS 12		// 4096 blocks on the 4Gb part
+	#define PAGE_BITS 6				// 64 pages per block
+	#define PLANE_BITS 1			// 2 planes, selected by A18
+	#define COLUMN_BITS 12			// 2048+64 byte pages
 #else
 	#error "No NAND flash chip is specified."
 #endif
 
+#define PAGE_COUNT (1 << PAGE_BITS)
+#define PLANE_COUNT (1 << PLANE_BITS)
+
 #define SPARE_START 2048
 #define PARA_SIZE 512
 #define PARA_SPARE_SIZE 16
 
 /**
- * Initialize pins and default state for NAND flash chip.
+ * Geometry of the attached chip, decoded from the ONFI parameter page by
+ * nand_read_geometry(). Parts whose page size, pages per block or plane count
+ * differ from the compiled layout are not accepted; only the block count may
+ * vary.
+ */
+typedef struct {
+	uint16_t page_size;			// data bytes per page
+	uint16_t spare_size;		// spare bytes per page
+	uint16_t pages_per_block;
+	uint16_t block_count;		// blocks in the (single) LUN
+	uint16_t plane_blocks;		// block b and b+plane_blocks are at the same offset in planes 0 and 1
+	uint8_t block_bits;			// log2 of block_count
+	uint8_t plane_count;
+	uint16_t timing_modes;		// bit n set if ONFI asynchronous timing mode n is supported
+	bool onfi;					// true if the geometry was read from the chip
+} NandGeometry;
+
+extern NandGeometry nand_geometry;
+
+/**
+ * Initialize pins and default state for NAND flash chip. This also reads the
+ * chip's geometry and, with NAND_DMA and NAND_FAST_TIMING, picks the timing
+ * profile it supports.
  */
 void nand_init();
 
+#ifdef NAND_DMA
+/**
+ * Strobe timing for DMA transfers, in SMCLK cycles from the start of each byte.
+ */
+typedef struct {
+	uint8_t period;		// cycles per byte
+	uint8_t re_low;		// RE# rises here
+	uint8_t re_sample;	// P1IN is sampled here, past tREA
+	uint8_t we_low;		// WE# rises here
+	uint8_t we_load;	// the next byte is put on the bus here, past tDH
+} NandTiming;
+
+typedef enum {
+	NAND_TIMING_MODE0,	// ONFI timing mode 0, which every part supports
+	NAND_TIMING_FAST,	// parts that report ONFI timing mode 1 or better
+} NandTimingProfile;
+
+/**
+ * Select the strobe timing for DMA transfers. nand_init selects mode 0, or with
+ * NAND_FAST_TIMING the fastest profile the chip reports support for.
+ */
+void nand_set_timing(NandTimingProfile profile);
+
+/**
+ * Get the strobe timing profile in use.
+ */
+NandTimingProfile nand_get_timing();
+#endif
+
 /**
  * Structure of the information returned by a read_id check.
  */
@@ -44,9 +108,11 @@ typedef struct {
 /** Construct an address in NAND to produce a packed address as per the NAND chip's addressing scheme, using
 	the block index, the page index, and the column (byte offset). */
 inline uint32_t nand_make_addr(const uint32_t block,const uint32_t page,const uint32_t column) {
-	// On the S34ML01G2 the A18 line is the plane; we map the high bit of the block address to the plane.
-	uint32_t addr = (column << 0) | (page << 12) | ( ((block / 1024)&0x01) << 18) | ( (block % 1024) << 19);
-	return addr;
+	// The plane bits (A18 on the S34ML01G2) sit between the page and the block offset within the
+	// plane; we map the high bit(s) of the block index to the plane.
+	return column | (page << COLUMN_BITS) |
+			((uint32_t)(block >= nand_geometry.plane_blocks) << (COLUMN_BITS + PAGE_BITS)) |
+			((block & (nand_geometry.plane_blocks - 1)) << (COLUMN_BITS + PAGE_BITS + PLANE_BITS));
 }
 
 /** Construct an address in NAND to produce a packed address as per the NAND chip's addressing scheme, using
@@ -55,6 +121,21 @@ inline uint32_t nand_make_para_addr(const uint32_t block,const uint32_t page,con
 	return nand_make_addr(block,page,para*(PARA_SIZE+PARA_SPARE_SIZE));
 }
 
+/** Convert a block index and page index into a pad-wide page number. */
+inline uint32_t nand_page_number(const uint16_t block,const uint16_t page) {
+	return (((uint32_t)block) << PAGE_BITS) | page;
+}
+
+/** Get the block index of a pad-wide page number. */
+inline uint16_t nand_page_block(const uint32_t page) {
+	return page >> PAGE_BITS;
+}
+
+/** Get the page index within its block of a pad-wide page number. */
+inline uint16_t nand_page_index(const uint32_t page) {
+	return page & (PAGE_COUNT - 1);
+}
+
 /**
  * Receive raw data from the NAND flash; useful for "continuations" of read_raw_page
  */
@@ -84,6 +165,13 @@ uint8_t nand_read_status_reg();
  */
 void nand_block_erase(uint16_t block);
 
+/**
+ * Erase a block in plane 0 and the block at the same offset in plane 1 (block +
+ * plane_blocks in nand_geometry) with a single multi-plane erase.
+ * @param block the index of the block in plane 0 to erase
+ */
+void nand_block_erase_planes(uint16_t block);
+
 /**
  * Read raw data from NAND. You can use nand_recv_data to continue to retrieve data
  * at successive addresses after the read completes.
@@ -93,11 +181,13 @@ void nand_block_erase(uint16_t block);
  */
 void nand_read_raw_page(uint32_t address, uint8_t* buffer, uint16_t count);
 
-struct checksum_ret {uint16_t checksum;bool ok;};
+struct checksum_ret {uint32_t crc;bool ok;uint16_t corrected;};
 /**
- * Compute the trivial checksum of a block.
+ * Read a block back and compute the CRC-32 of its data (see crc32.h), over the
+ * 512 data bytes of each paragraph in order.
  * @block the index of the block to generate a checksum for
- * @return the computed checksum and a flag indicating any errors
+ * @return the computed CRC, a flag indicating any errors, and the number
+ * of bits corrected while reading the block
  */
 struct checksum_ret nand_block_checksum(uint16_t block);
 
@@ -110,23 +200,90 @@ struct checksum_ret nand_block_checksum(uint16_t block);
  */
 bool nand_program_raw_page(const uint32_t address, const uint8_t* buffer, const uint16_t count);
 
+/**
+ * Error correction codes available for the spare area of each paragraph.
+ */
+typedef enum {
+	NAND_ECC_SECDED, // 25-bit SEC-DED code (ecc.h), corrects one bit
+	NAND_ECC_BCH     // 52-bit BCH code (bch.h), corrects BCH_T bits
+} NandEccMode;
+
+/**
+ * Select the code used by nand_load_para and nand_save_para. The header
+ * paragraph is always written with NAND_ECC_SECDED so that it can be read
+ * before the mode of the pad is known.
+ * @param mode the code to use for subsequent paragraph reads and writes
+ */
+void nand_set_ecc_mode(NandEccMode mode);
+
+/**
+ * Get the code currently used for paragraph reads and writes.
+ */
+NandEccMode nand_get_ecc_mode();
+
+/**
+ * Get the number of bits corrected by the last call to nand_load_para.
+ */
+uint8_t nand_para_corrected_bits();
+
 /**
  * Initialize the page buffer with unprogrammed (0xff) values.
  */
 void nand_initialize_para_buffer();
 
 /**
- * Load an entire paragraph into the paragraph buffer. Uses a Huffman code for SEC-DED on each 512B paragraph.
+ * Load an entire paragraph into the paragraph buffer. Each 512B paragraph is checked and corrected with
+ * the code selected by nand_set_ecc_mode.
  * @param block the block index
  * @param page the page number
  * @param paragraph the paragraph within the page to zero (0-3).
- * @return true if the read was successful; false if there was a multibit error.
+ * @return true if the read was successful; false if there were more errors than the code can correct.
  */
 bool nand_load_para(uint16_t block, uint8_t page, uint8_t paragraph);
 
 /**
- * Write an entire page from the page buffer into NAND with SEC-DED error correction.
- * At present, blocks until entire page write is complete.
+ * Load a page from the array into the chip's data register, so that its paragraphs can
+ * be fetched with nand_page_para at the cost of a single array read.
+ * @param block the block index
+ * @param page the page number
+ */
+void nand_load_page(uint16_t block, uint8_t page);
+
+/**
+ * Fetch a paragraph of the page loaded by nand_load_page into the paragraph buffer,
+ * checked and corrected as by nand_load_para. Paragraphs may be fetched in any order,
+ * until another NAND operation replaces the contents of the data register.
+ * @param paragraph the paragraph within the page (0-3).
+ * @return true if the read was successful; false if there were more errors than the code can correct.
+ */
+bool nand_page_para(uint8_t paragraph);
+
+/**
+ * Start streaming the paragraphs of a block with the chip's sequential cache read, so
+ * that each page is loaded from the array while the one before it is being read out.
+ * Fetch the paragraphs in order with nand_stream_next_para, and finish with
+ * nand_stream_end. No other NAND operation may be issued until the stream ends.
+ * @param block the block index
+ * @param page the first page to read
+ */
+void nand_stream_begin(uint16_t block, uint8_t page);
+
+/**
+ * Load the next paragraph of the stream into the paragraph buffer, checked and
+ * corrected as by nand_load_para. Do not read past the last page of the block.
+ * @return true if the read was successful; false if there were more errors than the code can correct.
+ */
+bool nand_stream_next_para();
+
+/**
+ * End a stream started by nand_stream_begin and take the chip out of cache read mode.
+ */
+void nand_stream_end();
+
+/**
+ * Write an entire page from the page buffer into NAND with the code selected by nand_set_ecc_mode.
+ * Returns once the data is loaded; the program itself completes in the background
+ * (see nand_wait_for_ready).
  * @param block the block index
  * @param page the page number
  * @param paragraph the paragraph within the page to zero (0-3).
@@ -134,6 +291,34 @@ bool nand_load_para(uint16_t block, uint8_t page, uint8_t paragraph);
  */
 bool nand_save_para(uint16_t block, uint8_t page, uint8_t paragraph);
 
+/**
+ * Load the paragraph buffer into the chip's page register as part of a cached page
+ * program, with error correction as for nand_save_para. The paragraphs of a page must
+ * be sent paragraph 0 first and paragraph 3 last, with no other NAND operation in
+ * between; 1 and 2 can come in either order. Once paragraph 3 is loaded the page
+ * is programmed with the cache program command, so the next page can be loaded
+ * while it is written; the last page of the block is programmed normally. Call
+ * nand_wait_for_ready after the last page before any other operation.
+ * @param block the block index
+ * @param page the page number
+ * @param paragraph the paragraph within the page (0-3).
+ * @return true if the paragraph was loaded
+ */
+bool nand_cache_para(uint16_t block, uint8_t page, uint8_t paragraph);
+
+/**
+ * Load the paragraph buffer as part of a two-plane cached page program, which writes a
+ * page of a block in plane 0 and the same page of the block at the same offset in plane 1
+ * (block + nand_geometry.plane_blocks) together. The four paragraphs of the plane 0 page must be sent
+ * first, then those of the plane 1 page, with no other NAND operation in between. Otherwise
+ * this behaves as nand_cache_para.
+ * @param block the block index (in either plane)
+ * @param page the page number
+ * @param paragraph the paragraph within the page (0-3).
+ * @return true if the paragraph was loaded
+ */
+bool nand_cache_plane_para(uint16_t block, uint8_t page, uint8_t paragraph);
+
 /**
  * Retrieve a pointer to the 528B page buffer. The area from 512B-528B is the spare
  * data area; this data should rarely be directly manipulated by the client.
@@ -141,14 +326,15 @@ bool nand_save_para(uint16_t block, uint8_t page, uint8_t paragraph);
 uint8_t* nand_para_buffer();
 
 /**
- * Zero a 512B paragraph and its associated spare area. This should be done immediately
- * after using a paragraph.
+ * Zero consecutive 512B paragraphs of a page and their associated spare areas with a
+ * single program operation. This should be done immediately after using a paragraph.
  * @param block the block number index
  * @param page the page number
- * @param paragraph the paragraph within the page to zero (0-3).
+ * @param paragraph the first paragraph within the page to zero (0-3).
+ * @param count the number of paragraphs to zero (1-4, not past the end of the page).
  * @return true if the zero was successful
  */
-bool nand_zero_paragraph(uint16_t block, uint8_t page, uint8_t paragraph);
+bool nand_zero_paragraphs(uint16_t block, uint8_t page, uint8_t paragraph, uint8_t count);
 
 /**
  * Zero an entire page and its spare area.
@@ -157,14 +343,134 @@ bool nand_zero_paragraph(uint16_t block, uint8_t page, uint8_t paragraph);
  */
 bool nand_zero_page(uint32_t address);
 
+/**
+ * Decode the ONFI parameter page into nand_geometry. The redundant copies of the
+ * page are tried in turn until one passes its CRC. If none does, or the part does
+ * not match the compiled page layout, nand_geometry keeps the default geometry.
+ * @return true if the geometry was read from the chip.
+ */
+bool nand_read_geometry();
+
 /**
  * Read parameter page data into a buffer.
  */
 void nand_read_parameter_page(uint8_t* buffer, uint16_t count);
 
 /**
- * Wait for nand to finish any previous operations.
+ * Wait for nand to finish any previous operations. If interrupts are enabled the CPU
+ * sleeps in LPM0 until the ready interrupt, so interrupt handlers keep running.
  */
 void nand_wait_for_ready();
 
+/**
+ * Asynchronous operations
+ *
+ * The nand_submit_* calls issue an array operation and return as soon as the chip
+ * has been given it, without waiting for the array. Completion can be polled with
+ * nand_is_ready, waited for with nand_wait_for_ready, or signalled by a handler
+ * installed with nand_set_ready_handler. No other NAND operation may be issued
+ * until the chip is ready again. The blocking calls above are wrappers around these.
+ */
+
+/**
+ * Handler for the end of an array operation. Called from the ready interrupt, so it
+ * must be short and must not issue NAND operations itself.
+ */
+typedef void (*NandReadyHandler)();
+
+/**
+ * Install a handler to be called each time the chip becomes ready.
+ * @param handler the handler, or 0 for none
+ */
+void nand_set_ready_handler(NandReadyHandler handler);
+
+/**
+ * Check whether the chip has finished the last operation.
+ * @return true if the chip is ready
+ */
+bool nand_is_ready();
+
+/**
+ * Start erasing a block.
+ * @param block the index of the block to erase
+ */
+void nand_submit_erase(uint16_t block);
+
+/**
+ * Start erasing a block in each plane, as nand_block_erase_planes.
+ * @param block the index of the block in plane 0 to erase
+ */
+void nand_submit_erase_planes(uint16_t block);
+
+/**
+ * Send the paragraph buffer, with its error correction code, and start programming it.
+ * @param block the block index
+ * @param page the page number
+ * @param paragraph the paragraph within the page (0-3).
+ */
+void nand_submit_program_para(uint16_t block, uint8_t page, uint8_t paragraph);
+
+/**
+ * Start loading the page holding a paragraph from the array. Once the chip is ready,
+ * fetch the paragraph with nand_collect_para.
+ * @param block the block index
+ * @param page the page number
+ * @param paragraph the paragraph within the page (0-3).
+ */
+void nand_submit_read_para(uint16_t block, uint8_t page, uint8_t paragraph);
+
+/**
+ * Fetch the paragraph requested by nand_submit_read_para into the paragraph buffer,
+ * checked and corrected as by nand_load_para.
+ * @return true if the read was successful; false if there were more errors than the code can correct.
+ */
+bool nand_collect_para();
+
+#ifdef DEBUG
+/**
+ * Bus throughput of the data phase of each kind of operation, in bytes per ms.
+ */
+typedef struct {
+	uint16_t read;
+	uint16_t program;
+	uint16_t zero;
+} NandThroughput;
+
+/**
+ * Measure the bus throughput with the timing profile in use. Only the data transfers are
+ * timed, not the array operations. The block is erased, and its first pages are then
+ * programmed, read back and zeroed, so it must not hold pad data.
+ * @param block the index of a scratch block
+ */
+NandThroughput nand_measure_throughput(uint16_t block);
+#endif
+
+#ifdef NAND_STATS
+/**
+ * Counts of NAND operations since the last nand_reset_stats.
+ */
+typedef struct {
+	uint32_t array_reads;		// pages read from the array into the page register
+	uint32_t page_programs;		// pages programmed with a full page of data
+	uint32_t partial_programs;	// pages programmed with less than a full page
+	uint32_t erases;			// blocks erased
+	uint32_t bytes_in;			// data bytes clocked out of the chip
+	uint32_t bytes_out;			// data bytes clocked into the chip
+	uint32_t corrected_bits;	// bits corrected by the ECC
+	uint32_t ecc_failures;		// paragraphs with more errors than the ECC can correct
+	uint32_t busy_waits;		// calls to nand_wait_for_ready that found the chip busy
+	uint32_t busy_usec;			// time spent waiting in those calls
+} NandStats;
+
+/**
+ * Get the operation counters.
+ */
+const NandStats* nand_get_stats();
+
+/**
+ * Zero the operation counters.
+ */
+void nand_reset_stats();
+#endif
+
 #endif /* NAND_H_ */
@@ -0,0 +1,101 @@
+#include "nand.h"
+#include <stdio.h>
+
+/** The default geometry of nand.c; the tests change the block count. */
+NandGeometry nand_geometry = { 2048, 64, 64, 2048, 1024, 11, 2, 0x0001, false };
+
+void set_block_bits(uint8_t bits) {
+  nand_geometry.block_bits = bits;
+  nand_geometry.block_count = 1 << bits;
+  nand_geometry.plane_blocks = 1 << (bits - 1);
+}
+
+/** The division based packing that nand_make_addr replaced. */
+uint32_t old_make_addr(const uint32_t block,const uint32_t page,const uint32_t column) {
+  uint32_t addr = (column << 0) | (page << 12) | ( ((block / 1024)&0x01) << 18) | ( (block % 1024) << 19);
+  return addr;
+}
+
+uint32_t old_make_para_addr(const uint32_t block,const uint32_t page,const uint32_t para) {
+  return old_make_addr(block,page,para*(PARA_SIZE+PARA_SPARE_SIZE));
+}
+
+/** The division based packing, for any two-plane block count. */
+uint32_t div_make_addr(const uint32_t block,const uint32_t page,const uint32_t column) {
+  uint32_t plane_blocks = nand_geometry.block_count / 2;
+  return column + page * 4096 + (block / plane_blocks) * 262144 + (block % plane_blocks) * 524288;
+}
+
+uint16_t old_plane_partner(uint16_t block) {
+  return (block < 1024)?(block + 1024):(block - 1024);
+}
+
+bool check_addrs() {
+  for (uint32_t block = 0; block < nand_geometry.block_count; block++) {
+    for (uint32_t page = 0; page < PAGE_COUNT; page++) {
+      for (uint32_t column = 0; column < SPARE_START + 64; column++) {
+        if (nand_make_addr(block,page,column) != old_make_addr(block,page,column)) {
+          printf("Mismatch at block %u page %u column %u\n",block,page,column);
+          return false;
+        }
+      }
+      for (uint32_t para = 0; para < 4; para++) {
+        if (nand_make_para_addr(block,page,para) != old_make_para_addr(block,page,para)) {
+          printf("Mismatch at block %u page %u para %u\n",block,page,para);
+          return false;
+        }
+      }
+    }
+  }
+  return true;
+}
+
+bool check_large_addrs() {
+  set_block_bits(12);
+  for (uint32_t block = 0; block < nand_geometry.block_count; block++) {
+    for (uint32_t page = 0; page < PAGE_COUNT; page++) {
+      for (uint32_t column = 0; column < SPARE_START + 128; column += 8) {
+        if (nand_make_addr(block,page,column) != div_make_addr(block,page,column)) {
+          printf("Mismatch at block %u page %u column %u of 4096 blocks\n",block,page,column);
+          set_block_bits(11);
+          return false;
+        }
+      }
+    }
+  }
+  set_block_bits(11);
+  return true;
+}
+
+bool check_page_numbers() {
+  for (uint32_t page = 0; page < nand_geometry.block_count * PAGE_COUNT; page++) {
+    uint16_t block = nand_page_block(page);
+    uint16_t idx = nand_page_index(page);
+    if (block != page/64 || idx != page%64 || nand_page_number(block,idx) != page) {
+      printf("Mismatch at page %u\n",page);
+      return false;
+    }
+  }
+  return true;
+}
+
+bool check_partners() {
+  for (uint16_t block = 0; block < nand_geometry.block_count; block++) {
+    if ((block ^ nand_geometry.plane_blocks) != old_plane_partner(block) ||
+        (block & (nand_geometry.plane_blocks - 1)) != block % 1024) {
+      printf("Mismatch at block %u\n",block);
+      return false;
+    }
+  }
+  return true;
+}
+
+int main(int argc, char** argv) {
+  int failures = 0;
+  if (!check_addrs()) { failures++; }
+  if (!check_large_addrs()) { failures++; }
+  if (!check_page_numbers()) { failures++; }
+  if (!check_partners()) { failures++; }
+  printf("%d failures.\n",failures);
+  return failures;
+}
@@ -0,0 +1,668 @@
+/*
+ * nand_sim.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: phooky
+ */
+
+#define _DEFAULT_SOURCE
+#include "nand_sim.h"
+#include "nand.h"
+#include "ecc.h"
+#include "bch.h"
+#include "crc32.h"
+#include "buffers.h"
+#include <fcntl.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* nand.h declares these as C99 inline functions; this is the translation unit
+   that provides their external definitions. */
+extern inline uint32_t nand_make_addr(const uint32_t block,const uint32_t page,const uint32_t column);
+extern inline uint32_t nand_make_para_addr(const uint32_t block,const uint32_t page,const uint32_t para);
+extern inline uint32_t nand_page_number(const uint16_t block,const uint16_t page);
+extern inline uint16_t nand_page_block(const uint32_t page);
+extern inline uint16_t nand_page_index(const uint32_t page);
+
+#define PAGE_BYTES (4 * (PARA_SIZE + PARA_SPARE_SIZE))
+
+NandGeometry nand_geometry = {
+	SPARE_START,
+	PARA_SPARE_SIZE * 4,
+	PAGE_COUNT,
+	1 << BLOCK_BITS,
+	1 << (BLOCK_BITS - PLANE_BITS),
+	BLOCK_BITS,
+	PLANE_COUNT,
+	0x0001,
+	false
+};
+
+static NandSimConfig cfg;
+static NandSimStats sim_stats;
+#ifdef NAND_STATS
+static NandStats stats;
+#endif
+
+static int image_fd = -1;
+static uint8_t* image;
+static size_t image_size;
+static uint8_t* nop_counts;		// programs of each page since its block was erased
+
+static uint8_t data_reg[PAGE_BYTES];
+static uint8_t cache_reg[PAGE_BYTES];
+static uint8_t* out_reg = data_reg;	// register that data is read out of
+static uint16_t column;
+static uint32_t program_page;		// page the data register will be programmed into
+static uint16_t program_bytes;		// data bytes loaded since the program setup
+
+static uint64_t now;		// device time, ns
+static uint64_t ready_at;	// R/B# rises
+static uint64_t array_at;	// the array finishes its operation
+
+static NandEccMode ecc_mode = NAND_ECC_SECDED;
+static uint8_t corrected_bits = 0;
+static volatile NandReadyHandler ready_handler = 0;
+#ifdef NAND_DMA
+static NandTimingProfile timing_profile = NAND_TIMING_MODE0;
+#endif
+
+NandSimConfig nand_sim_default_config() {
+	NandSimConfig c;
+	c.t_r = 25000;
+	c.t_prog = 300000;
+	c.t_bers = 3000000;
+	c.t_cbsy = 3000;
+	c.t_dbsy = 500;
+	c.t_byte = 800;
+	c.t_secded = 1000;
+	c.t_bch = 3000;
+	c.t_cycle = 250;
+	c.nop = 4;
+	c.bit_error_rate = 0;
+	return c;
+}
+
+bool nand_sim_open(const char* path, uint16_t block_count, bool fresh, const NandSimConfig* config) {
+	struct stat st;
+	uint8_t bits;
+	for (bits = PLANE_BITS + 1; bits <= MAX_BLOCK_BITS; bits++) {
+		if (block_count == (1 << bits)) break;
+	}
+	if (bits > MAX_BLOCK_BITS) return false;
+	cfg = *config;
+	nand_geometry.block_count = block_count;
+	nand_geometry.plane_blocks = block_count >> PLANE_BITS;
+	nand_geometry.block_bits = bits;
+	nand_geometry.onfi = true;
+
+	image_size = (size_t)block_count * PAGE_COUNT * PAGE_BYTES;
+	image_fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (image_fd < 0) return false;
+	if (fstat(image_fd, &st) != 0) return false;
+	if ((size_t)st.st_size != image_size) fresh = true;
+	if (fresh && ftruncate(image_fd, image_size) != 0) return false;
+	image = mmap(NULL, image_size, PROT_READ | PROT_WRITE, MAP_SHARED, image_fd, 0);
+	if (image == MAP_FAILED) return false;
+	if (fresh) memset(image, 0xff, image_size);
+	// the image doesn't record partial programs, so a reopened chip starts fresh
+	nop_counts = calloc((size_t)block_count * PAGE_COUNT, 1);
+	now = ready_at = array_at = 0;
+	memset(&sim_stats, 0, sizeof(sim_stats));
+	return nop_counts != NULL;
+}
+
+void nand_sim_close() {
+	if (image_fd < 0) return;
+	msync(image, image_size, MS_SYNC);
+	munmap(image, image_size);
+	close(image_fd);
+	free(nop_counts);
+	image_fd = -1;
+}
+
+void nand_sim_mark_bad(uint16_t block) {
+	image[((uint32_t)block * PAGE_COUNT + 0) * PAGE_BYTES + SPARE_START] = 0x00;
+	image[((uint32_t)block * PAGE_COUNT + 1) * PAGE_BYTES + SPARE_START] = 0x00;
+	image[((uint32_t)block * PAGE_COUNT + PAGE_COUNT - 1) * PAGE_BYTES + SPARE_START] = 0x00;
+}
+
+const NandSimStats* nand_sim_get_stats() {
+	sim_stats.time_ns = now;
+	return &sim_stats;
+}
+
+void nand_sim_reset_stats() {
+	memset(&sim_stats, 0, sizeof(sim_stats));
+#ifdef NAND_STATS
+	nand_reset_stats();
+#endif
+}
+
+void nand_sim_advance(uint64_t time_ns) {
+	if (time_ns > now) now = time_ns;
+}
+
+void nand_sim_power_cycle() {
+	memset(data_reg, 0xff, PAGE_BYTES);
+	memset(cache_reg, 0xff, PAGE_BYTES);
+	out_reg = data_reg;
+	column = 0;
+	ready_at = array_at = now;
+}
+
+/**
+ * Chip model
+ *
+ * Each operation mirrors one command sequence of nand.c. Data moves when the
+ * command is given; only the timing is deferred, through ready_at (the R/B#
+ * line) and array_at (the array itself, which keeps working behind a cache
+ * read or cache program).
+ */
+
+/** Get the page number of a packed address, undoing nand_make_addr. */
+static uint32_t page_of(uint32_t address) {
+	uint32_t page = (address >> COLUMN_BITS) & (PAGE_COUNT - 1);
+	uint32_t plane = (address >> (COLUMN_BITS + PAGE_BITS)) & (PLANE_COUNT - 1);
+	uint32_t offset = address >> (COLUMN_BITS + PAGE_BITS + PLANE_BITS);
+	return ((plane * nand_geometry.plane_blocks) + offset) * PAGE_COUNT + page;
+}
+
+static uint64_t array_start() {
+	return (array_at > now)?array_at:now;
+}
+
+static void cycles(uint8_t count) {
+	now += (uint64_t)count * cfg.t_cycle;
+}
+
+/** Copy a page out of the array, flipping bits at the configured rate. */
+static void array_read(uint32_t page, uint8_t* reg) {
+	memcpy(reg, image + (size_t)page * PAGE_BYTES, PAGE_BYTES);
+#ifdef NAND_STATS
+	stats.array_reads++;
+#endif
+	if (cfg.bit_error_rate > 0) {
+		// geometric gaps between flipped bits
+		double bit = 0;
+		while (1) {
+			bit += floor(log(1.0 - drand48()) / log(1.0 - cfg.bit_error_rate));
+			if (bit >= PAGE_BYTES * 8) break;
+			reg[(uint32_t)bit / 8] ^= 1 << ((uint32_t)bit % 8);
+			sim_stats.bit_flips++;
+			bit++;
+		}
+	}
+}
+
+/** Program the data register into the page chosen by the program setup. */
+static void array_program() {
+	uint8_t* target = image + (size_t)program_page * PAGE_BYTES;
+	uint16_t i;
+	for (i = 0; i < PAGE_BYTES; i++) target[i] &= data_reg[i];
+	if (++nop_counts[program_page] > cfg.nop) sim_stats.nop_violations++;
+#ifdef NAND_STATS
+	if (program_bytes >= nand_geometry.page_size) {
+		stats.page_programs++;
+	} else {
+		stats.partial_programs++;
+	}
+#endif
+}
+
+/** 00h-address-30h */
+static void op_read(uint32_t address) {
+	uint64_t start;
+	cycles(7);
+	start = array_start();
+	array_read(page_of(address), data_reg);
+	out_reg = data_reg;
+	column = address & ((1 << COLUMN_BITS) - 1);
+	array_at = ready_at = start + cfg.t_r;
+}
+
+/** 31h (next true) or 3Fh: the data register moves to the cache register for output. */
+static void op_cache_read(uint32_t next_page, bool next) {
+	uint64_t start;
+	cycles(1);
+	start = array_start();
+	memcpy(cache_reg, data_reg, PAGE_BYTES);
+	out_reg = cache_reg;
+	column = 0;
+	ready_at = start + cfg.t_cbsy;
+	if (next) {
+		array_read(next_page, data_reg);
+		array_at = start + cfg.t_r;
+	} else {
+		array_at = ready_at;
+	}
+}
+
+/** 80h/81h-address: the data register is cleared to 0xff for the new data. */
+static void op_program_setup(uint32_t address) {
+	cycles(6);
+	memset(data_reg, 0xff, PAGE_BYTES);
+	program_page = page_of(address);
+	column = address & ((1 << COLUMN_BITS) - 1);
+	program_bytes = 0;
+}
+
+/** 05h/85h-column-E0h */
+static void op_column(uint16_t col) {
+	cycles(4);
+	column = col;
+}
+
+/** 10h (cache false) or 15h */
+static void op_program(bool cache) {
+	uint64_t start;
+	cycles(1);
+	array_program();
+	start = array_start();
+	array_at = start + cfg.t_prog;
+	ready_at = cache?(start + cfg.t_cbsy):array_at;
+}
+
+/** 11h: the first page of a two-plane program waits for the second. */
+static void op_program_queue() {
+	cycles(1);
+	array_program();
+	ready_at = now + cfg.t_dbsy;
+}
+
+static void erase_block(uint16_t block) {
+	memset(image + (size_t)block * PAGE_COUNT * PAGE_BYTES, 0xff, (size_t)PAGE_COUNT * PAGE_BYTES);
+	memset(nop_counts + (size_t)block * PAGE_COUNT, 0, PAGE_COUNT);
+#ifdef NAND_STATS
+	stats.erases++;
+#endif
+}
+
+/** Load data into the data register at the current column; NULL loads zeros. */
+static void data_in(const uint8_t* buffer, uint16_t count) {
+	uint16_t n = (column < PAGE_BYTES)?((count < PAGE_BYTES - column)?count:(PAGE_BYTES - column)):0;
+	if (buffer) {
+		memcpy(data_reg + column, buffer, n);
+	} else {
+		memset(data_reg + column, 0, n);
+	}
+	column += count;
+	program_bytes += count;
+	now += (uint64_t)count * cfg.t_byte;
+#ifdef NAND_STATS
+	stats.bytes_out += count;
+#endif
+}
+
+/** Read data out of the output register at the current column. */
+static void data_out(uint8_t* buffer, uint16_t count) {
+	uint16_t n = (column < PAGE_BYTES)?((count < PAGE_BYTES - column)?count:(PAGE_BYTES - column)):0;
+	memcpy(buffer, out_reg + column, n);
+	memset(buffer + n, 0xff, count - n);
+	column += count;
+	now += (uint64_t)count * cfg.t_byte;
+#ifdef NAND_STATS
+	stats.bytes_in += count;
+#endif
+}
+
+/**
+ * nand.h API
+ */
+
+void nand_init() {
+	nand_read_geometry();
+}
+
+#ifdef NAND_DMA
+void nand_set_timing(NandTimingProfile profile) {
+	timing_profile = profile;
+}
+
+NandTimingProfile nand_get_timing() {
+	return timing_profile;
+}
+#endif
+
+void nand_wait_for_ready() {
+	if (now >= ready_at) return;
+	sim_stats.busy_ns += ready_at - now;
+	now = ready_at;
+#ifdef NAND_STATS
+	stats.busy_waits++;
+	stats.busy_usec = sim_stats.busy_ns / 1000;
+#endif
+	if (ready_handler) ready_handler();
+}
+
+bool nand_is_ready() {
+	if (now >= ready_at) return true;
+	// each poll costs a microsecond of device time
+	now += 1000;
+	if (now >= ready_at && ready_handler) ready_handler();
+	return now >= ready_at;
+}
+
+void nand_set_ready_handler(NandReadyHandler handler) {
+	ready_handler = handler;
+}
+
+void nand_recv_data(uint8_t* buffer, uint16_t count) {
+	data_out(buffer, count);
+}
+
+IdInfo nand_read_id() {
+	// S34ML02G2
+	IdInfo info = { 0x01, 0xda, 0x90, 0x95, 0x46 };
+	cycles(2);
+	return info;
+}
+
+bool nand_check_ONFI() {
+	cycles(2);
+	return true;
+}
+
+uint8_t nand_read_status_reg() {
+	cycles(1);
+	// not write protected; ready and array ready bits
+	return 0x80 | ((now >= ready_at)?0x40:0) | ((now >= array_at)?0x20:0);
+}
+
+bool nand_read_geometry() {
+	return true;
+}
+
+void nand_read_parameter_page(uint8_t* buffer, uint16_t count) {
+	uint8_t param[256];
+	uint16_t i, crc = 0x4f4e;
+	uint8_t bit;
+	memset(param, 0, sizeof(param));
+	memcpy(param, "ONFI", 4);
+	param[80] = SPARE_START & 0xff; param[81] = SPARE_START >> 8;
+	param[84] = nand_geometry.spare_size;
+	param[92] = PAGE_COUNT;
+	param[96] = nand_geometry.block_count & 0xff; param[97] = nand_geometry.block_count >> 8;
+	param[100] = 1;
+	param[113] = PLANE_BITS;
+	param[129] = nand_geometry.timing_modes & 0xff; param[130] = nand_geometry.timing_modes >> 8;
+	for (i = 0; i < 254; i++) {
+		crc ^= ((uint16_t)param[i]) << 8;
+		for (bit = 0; bit < 8; bit++) crc = (crc & 0x8000)?((crc << 1) ^ 0x8005):(crc << 1);
+	}
+	param[254] = crc & 0xff; param[255] = crc >> 8;
+	for (i = 0; i < count; i++) buffer[i] = param[i % sizeof(param)];
+	cycles(2);
+	now += cfg.t_r + (uint64_t)count * cfg.t_byte;
+}
+
+void nand_submit_erase(uint16_t block) {
+	uint64_t start;
+	cycles(5);
+	erase_block(block);
+	start = array_start();
+	array_at = ready_at = start + cfg.t_bers;
+}
+
+void nand_block_erase(uint16_t block) {
+	nand_submit_erase(block);
+	nand_wait_for_ready();
+}
+
+void nand_submit_erase_planes(uint16_t block) {
+	uint64_t start;
+	cycles(9);
+	erase_block(block);
+	erase_block(block + nand_geometry.plane_blocks);
+	start = array_start();
+	array_at = ready_at = start + cfg.t_bers;
+}
+
+void nand_block_erase_planes(uint16_t block) {
+	nand_submit_erase_planes(block);
+	nand_wait_for_ready();
+}
+
+void nand_read_raw_page(uint32_t address, uint8_t* buffer, uint16_t count) {
+	op_read(address);
+	nand_wait_for_ready();
+	data_out(buffer, count);
+}
+
+bool nand_program_raw_page(const uint32_t address, const uint8_t* buffer, const uint16_t count) {
+	op_program_setup(address);
+	data_in(buffer, count);
+	op_program(false);
+	return true;
+}
+
+void nand_set_ecc_mode(NandEccMode mode) {
+	ecc_mode = mode;
+}
+
+NandEccMode nand_get_ecc_mode() {
+	return ecc_mode;
+}
+
+uint8_t nand_para_corrected_bits() {
+	return corrected_bits;
+}
+
+void nand_initialize_para_buffer() {
+	memset(buffers_get_nand(), 0xff, PARA_SIZE + PARA_SPARE_SIZE);
+}
+
+uint8_t* nand_para_buffer() {
+	return buffers_get_nand();
+}
+
+/** Hold a paragraph's transfer back to the CPU time of building its code. */
+static void code_time() {
+	const uint32_t t = (ecc_mode == NAND_ECC_BCH)?cfg.t_bch:cfg.t_secded;
+	if (t > cfg.t_byte) now += (uint64_t)PARA_SIZE * (t - cfg.t_byte);
+}
+
+/** As nand.c: receive the paragraph at the current column, then check and correct it. */
+static bool recv_para_checked() {
+	uint8_t* para_buffer = buffers_get_nand();
+	data_out(para_buffer, PARA_SIZE + PARA_SPARE_SIZE);
+	code_time();
+	corrected_bits = 0;
+	if (ecc_mode == NAND_ECC_BCH) {
+		uint8_t code[BCH_ECC_BYTES];
+		int8_t fixed;
+		bch_generate(para_buffer, code);
+		fixed = bch_correct(para_buffer, code, para_buffer + PARA_SIZE);
+		if (fixed < 0) {
+#ifdef NAND_STATS
+			stats.ecc_failures++;
+#endif
+			return false;
+		}
+		corrected_bits = fixed;
+	} else {
+		uint32_t ecc, stored;
+		int8_t fixed;
+		ecc = ecc_generate(para_buffer);
+		memcpy(&stored, para_buffer + PARA_SIZE, sizeof(stored));
+		fixed = ecc_correct(para_buffer, ecc, stored);
+		if (fixed < 0) {
+#ifdef NAND_STATS
+			stats.ecc_failures++;
+#endif
+			return false;
+		}
+		corrected_bits = fixed;
+	}
+#ifdef NAND_STATS
+	stats.corrected_bits += corrected_bits;
+#endif
+	return true;
+}
+
+/** As nand.c: send the paragraph buffer with its code at the start of the spare area. */
+static void send_para_coded() {
+	uint8_t* para_buffer = buffers_get_nand();
+	if (ecc_mode == NAND_ECC_BCH) {
+		bch_generate(para_buffer, para_buffer + PARA_SIZE);
+	} else {
+		uint32_t ecc = ecc_generate(para_buffer);
+		memcpy(para_buffer + PARA_SIZE, &ecc, sizeof(ecc));
+	}
+	data_in(para_buffer, PARA_SIZE + PARA_SPARE_SIZE);
+	code_time();
+}
+
+bool nand_load_para(uint16_t block, uint8_t page, uint8_t paragraph) {
+	nand_submit_read_para(block, page, paragraph);
+	nand_wait_for_ready();
+	return nand_collect_para();
+}
+
+void nand_submit_read_para(uint16_t block, uint8_t page, uint8_t paragraph) {
+	op_read(nand_make_para_addr(block, page, paragraph));
+}
+
+bool nand_collect_para() {
+	return recv_para_checked();
+}
+
+void nand_load_page(uint16_t block, uint8_t page) {
+	op_read(nand_make_para_addr(block, page, 0));
+	nand_wait_for_ready();
+}
+
+bool nand_page_para(uint8_t paragraph) {
+	op_column(paragraph * (PARA_SIZE + PARA_SPARE_SIZE));
+	return recv_para_checked();
+}
+
+static uint16_t stream_block;
+static uint8_t stream_page;
+static uint8_t stream_para;
+static bool stream_loading;
+
+void nand_stream_begin(uint16_t block, uint8_t page) {
+	stream_block = block;
+	stream_page = page;
+	stream_para = 0;
+	stream_loading = false;
+	op_read(nand_make_para_addr(block, page, 0));
+	nand_wait_for_ready();
+}
+
+bool nand_stream_next_para() {
+	bool ok;
+	if (stream_para == 0) {
+		stream_loading = stream_page < PAGE_COUNT - 1;
+		op_cache_read(page_of(nand_make_addr(stream_block, stream_page + 1, 0)), stream_loading);
+		nand_wait_for_ready();
+	}
+	ok = recv_para_checked();
+	if (++stream_para == 4) {
+		stream_para = 0;
+		stream_page++;
+	}
+	return ok;
+}
+
+void nand_stream_end() {
+	if (stream_loading) {
+		op_cache_read(0, false);
+		nand_wait_for_ready();
+		stream_loading = false;
+	}
+}
+
+struct checksum_ret nand_block_checksum(uint16_t block) {
+	struct checksum_ret rv = {CRC32_INIT,true,0};
+	uint16_t para;
+	uint8_t* para_buffer = buffers_get_nand();
+	nand_stream_begin(block,0);
+	for (para = 0; para < PAGE_COUNT*4; para++) {
+		if (nand_stream_next_para()) {
+			rv.corrected += corrected_bits;
+			rv.crc = crc32_update(rv.crc, para_buffer, PARA_SIZE);
+		} else {
+			rv.ok = false;
+		}
+	}
+	nand_stream_end();
+	rv.crc = crc32_finish(rv.crc);
+	return rv;
+}
+
+bool nand_save_para(uint16_t block, uint8_t page, uint8_t paragraph) {
+	nand_submit_program_para(block, page, paragraph);
+	return true;
+}
+
+void nand_submit_program_para(uint16_t block, uint8_t page, uint8_t paragraph) {
+	op_program_setup(nand_make_para_addr(block, page, paragraph));
+	send_para_coded();
+	op_program(false);
+}
+
+bool nand_cache_para(uint16_t block, uint8_t page, uint8_t paragraph) {
+	if (paragraph == 0) {
+		nand_wait_for_ready();
+		op_program_setup(nand_make_para_addr(block, page, 0));
+	} else {
+		op_column(paragraph * (PARA_SIZE + PARA_SPARE_SIZE));
+	}
+	send_para_coded();
+	if (paragraph == 3) {
+		op_program(page < PAGE_COUNT - 1);
+	}
+	return true;
+}
+
+bool nand_cache_plane_para(uint16_t block, uint8_t page, uint8_t paragraph) {
+	bool first_plane = block < nand_geometry.plane_blocks;
+	if (paragraph == 0) {
+		if (first_plane) nand_wait_for_ready();
+		op_program_setup(nand_make_para_addr(block, page, 0));
+	} else {
+		op_column(paragraph * (PARA_SIZE + PARA_SPARE_SIZE));
+	}
+	send_para_coded();
+	if (paragraph == 3) {
+		if (first_plane) {
+			op_program_queue();
+			nand_wait_for_ready();
+		} else {
+			op_program(page < PAGE_COUNT - 1);
+		}
+	}
+	return true;
+}
+
+bool nand_zero_paragraphs(uint16_t block, uint8_t page, uint8_t paragraph, uint8_t count) {
+	op_program_setup(nand_make_para_addr(block, page, paragraph));
+	data_in(NULL, count * (PARA_SIZE + PARA_SPARE_SIZE));
+	op_program(false);
+	nand_wait_for_ready();
+	return true;
+}
+
+bool nand_zero_page(uint32_t address) {
+	op_program_setup(address);
+	data_in(NULL, PAGE_BYTES);
+	op_program(false);
+	nand_wait_for_ready();
+	return true;
+}
+
+#ifdef NAND_STATS
+const NandStats* nand_get_stats() {
+	return &stats;
+}
+
+void nand_reset_stats() {
+	memset(&stats, 0, sizeof(stats));
+}
+#endif
@@ -0,0 +1,148 @@
+/*
+ * nand_sim.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: phooky
+ */
+
+#ifndef NAND_SIM_H_
+#define NAND_SIM_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <setjmp.h>
+
+/**
+ * Host build of the nand.h API, backed by a memory-mapped image file instead of
+ * the chip. The image holds every page with its spare area (2112B), so it can be
+ * reopened to continue with the same pad.
+ *
+ * The model follows the S34ML parts: erased bits are 1, programs can only clear
+ * bits, each page takes a limited number of partial programs (NOP) between
+ * erases, and reads can flip bits at a configurable rate. Device time advances
+ * by the configured latencies and bus rates, with the chip's page and cache
+ * registers overlapping array operations the way the real part does. The board
+ * builds a paragraph's code as the DMA moves its bytes, so its data crosses the
+ * bus no faster than the CPU can build the code.
+ */
+typedef struct {
+	uint32_t t_r;			// page read into the data register, ns
+	uint32_t t_prog;		// page program, ns
+	uint32_t t_bers;		// block erase, ns
+	uint32_t t_cbsy;		// busy time of a cache read or cache program, ns
+	uint32_t t_dbsy;		// busy time queueing the first page of a two-plane program, ns
+	uint32_t t_byte;		// data byte on the bus, ns
+	uint32_t t_secded;		// CPU time building a paragraph's SEC-DED code, per data byte, ns
+	uint32_t t_bch;			// CPU time building a paragraph's BCH code, per data byte, ns
+	uint32_t t_cycle;		// command or address cycle, ns
+	uint8_t nop;			// partial programs allowed per page between erases
+	double bit_error_rate;	// chance of each bit read from the array coming back flipped
+} NandSimConfig;
+
+/** Counts the nand.h NandStats don't cover. */
+typedef struct {
+	uint64_t time_ns;		// device time
+	uint64_t busy_ns;		// device time spent in nand_wait_for_ready
+	uint32_t nop_violations;	// programs of a page past its NOP limit
+	uint32_t bit_flips;		// bits flipped on reads
+} NandSimStats;
+
+/**
+ * Get the datasheet timing of the S34ML01G2, with an 800ns DMA byte and no bit errors.
+ * The code building times are estimates for the MSP430 at 20MHz, of about 20 cycles
+ * per byte for SEC-DED and 60 for BCH; they have not been measured on a board.
+ */
+NandSimConfig nand_sim_default_config();
+
+/**
+ * Open or create the image backing the simulated chip, and set nand_geometry for it.
+ * @param path the image file
+ * @param block_count the number of blocks; a power of two no larger than 1 << MAX_BLOCK_BITS
+ * @param fresh true to start from an erased chip even if the image exists
+ * @param config the timing and error model
+ * @return true if the image is ready
+ */
+bool nand_sim_open(const char* path, uint16_t block_count, bool fresh, const NandSimConfig* config);
+
+/**
+ * Flush and unmap the image.
+ */
+void nand_sim_close();
+
+/**
+ * Mark a block bad the way the factory does, with a zero in the first spare byte of
+ * its first, second and last pages.
+ */
+void nand_sim_mark_bad(uint16_t block);
+
+/**
+ * Get the simulator's own counters.
+ */
+const NandSimStats* nand_sim_get_stats();
+
+/**
+ * Zero the simulator's counters and the nand.h NandStats; device time is kept.
+ */
+void nand_sim_reset_stats();
+
+/**
+ * Let device time pass while the rest of the board works or waits. An operation
+ * the chip has in progress carries on meanwhile.
+ * @param time_ns the device time to advance to; a time already past is ignored
+ */
+void nand_sim_advance(uint64_t time_ns);
+
+/**
+ * Lose power and come back: the registers are cleared and an operation in
+ * progress stops where it is. The array keeps what was programmed into it.
+ */
+void nand_sim_power_cycle();
+
+/**
+ * Host stand-ins for the rest of the board (sim_stubs.c). The UART answers as a
+ * twin that acknowledges everything it is sent and keeps block checksums of the
+ * data it received, so randomization runs to completion. The twin's randomization
+ * checkpoints survive a simulated power failure; nothing else it holds does.
+ *
+ * The RNG, the UART, the CRC-32 and the twin take device time as set in
+ * sim_board; zero makes a stage instant. The link wraps crc32_update (see the
+ * Makefile), so the firmware's CRCs of whole buffers cost the board CPU time. Polling a stage that isn't done costs a microsecond,
+ * as nand_is_ready does.
+ */
+typedef struct {
+	uint32_t rng_byte;		// RNG fill, ns per byte
+	uint32_t uart_byte;		// UART transfer, ns per byte
+	uint32_t twin_para;		// the twin loading a paragraph it received into its chip, ns
+	uint32_t twin_erase;	// the twin erasing a block before loading its first paragraph, ns
+	uint32_t twin_checksum;	// the twin reading a block back to check it (OTP_READBACK_VERIFY), ns
+	uint32_t crc_byte;		// either board's CPU adding a buffer to a CRC-32, ns per byte
+	uint64_t power_fail_at;	// device time both boards lose power, at the next UART send; 0 for never
+} SimBoardConfig;
+
+extern SimBoardConfig sim_board;
+
+/** Where a power failure (see SimBoardConfig) jumps to. */
+extern jmp_buf sim_power_fail;
+
+/**
+ * Bring both boards back up after a power failure, with what each has in NAND.
+ */
+void sim_power_cycle();
+extern bool sim_verbose;			// echo USB output to stdout
+
+/** Get the number of pad bytes emitted as base64 since the last call. */
+uint32_t sim_take_pad_bytes();
+
+/**
+ * Get the number of bytes lost since the last call because they reached the twin
+ * while its 64-byte receive ring was full.
+ */
+uint32_t sim_take_twin_overruns();
+
+/**
+ * Get the number of bytes from the twin read since the last call with the board's
+ * own 64-byte receive ring already full, which the real board would have lost.
+ */
+uint32_t sim_take_rx_overruns();
+
+#endif /* NAND_SIM_H_ */
@@ -0,0 +1,207 @@
+#define _DEFAULT_SOURCE
+#include "nand_sim.h"
+#include "nand.h"
+#include "onetimepad.h"
+#include "buffers.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/**
+ * Benchmark the onetimepad functions against the simulated NAND.
+ *
+ * A fresh image is given a header and randomized (against the fake twin in
+ * sim_stubs.c) before the benchmarks run; an existing image of the right size is
+ * reused as it is, so provisioning picks up where the last run stopped.
+ *
+ * The UART runs at the rate uarts.c sets up (12MHz / 26, ten bits a byte). The RNG is
+ * instant unless given a rate; the twin takes as long as the simulated chip, with the
+ * same code building and CRC-32 times, to load, erase and checksum. Randomization can be interrupted by a simulated power failure,
+ * to time how it resumes.
+ */
+
+static void usage() {
+	fprintf(stderr,
+		"usage: otp_bench [options] [image]\n"
+		"  -b blocks   chip size in blocks (default 2048)\n"
+		"  -f          start from an erased image even if it exists\n"
+		"  -B count    factory bad blocks to place on a fresh image\n"
+		"  -e rate     bit error rate of array reads (default 0)\n"
+		"  -r ns       tR, page read (default 25000)\n"
+		"  -p ns       tPROG, page program (default 300000)\n"
+		"  -E ns       tBERS, block erase (default 3000000)\n"
+		"  -t ns       data byte time on the bus (default 800)\n"
+		"  -c ns       CPU time per byte building a SEC-DED code (default 1000)\n"
+		"  -C ns       CPU time per byte building a BCH code (default 3000)\n"
+		"  -k ns       CPU time per byte of a CRC-32 (default 1250)\n"
+		"  -n count    partial programs allowed per page (default 4)\n"
+		"  -g ns       RNG time per byte (default 0)\n"
+		"  -u ns       UART time per byte (default 21667)\n"
+		"  -i ms       cut the power this far into randomization, then resume it\n"
+		"  -s count    otp_find_unmarked_block calls (default 100)\n"
+		"  -P count    pages to provision (default 64)\n"
+		"  -R count    random pages to retrieve (default 64)\n"
+		"  -A          provision as board B (from the end of the chip)\n"
+		"  -x          skip the factory reset\n"
+		"  -v          echo the USB output\n");
+	exit(1);
+}
+
+static uint64_t phase_start;
+
+static void begin_phase() {
+	nand_sim_reset_stats();
+	sim_take_pad_bytes();
+	phase_start = nand_sim_get_stats()->time_ns;
+}
+
+static void end_phase(const char* name, uint32_t calls) {
+	const NandSimStats* sim = nand_sim_get_stats();
+	const NandStats* stats = nand_get_stats();
+	const uint64_t elapsed = sim->time_ns - phase_start;
+	printf("%s\n", name);
+	printf("  calls             %u\n", calls);
+	printf("  device time       %.3f ms\n", elapsed / 1e6);
+	if (calls > 0) printf("  per call          %.1f us\n", elapsed / 1e3 / calls);
+	printf("  busy time         %.3f ms in %u waits\n", sim->busy_ns / 1e6, stats->busy_waits);
+	printf("  array reads       %u\n", stats->array_reads);
+	printf("  page programs     %u (+%u partial)\n", stats->page_programs, stats->partial_programs);
+	printf("  erases            %u\n", stats->erases);
+	printf("  bytes in/out      %u/%u\n", stats->bytes_in, stats->bytes_out);
+	printf("  NOP violations    %u\n", sim->nop_violations);
+	printf("  bit flips         %u (%u corrected, %u failed paragraphs)\n",
+		sim->bit_flips, stats->corrected_bits, stats->ecc_failures);
+	printf("  pad bytes         %u\n", sim_take_pad_bytes());
+	printf("  twin overruns     %u\n", sim_take_twin_overruns());
+	printf("  rx overruns       %u\n", sim_take_rx_overruns());
+}
+
+static void print_stall(const char* name, uint32_t usec, uint32_t run_usec) {
+	printf("  %-17s %.3f ms (%.1f%%)\n", name, usec / 1e3, run_usec ? 100.0 * usec / run_usec : 0);
+}
+
+static void print_randomize_stats() {
+	const RandomizeStats* rnd = otp_get_randomize_stats();
+	printf("  paragraphs        %u in %.3f ms\n", rnd->paragraphs, rnd->run_usec / 1e3);
+	print_stall("RNG stalls", rnd->rng_usec, rnd->run_usec);
+	print_stall("UART stalls", rnd->uart_usec, rnd->run_usec);
+	print_stall("NAND loads", rnd->nand_usec, rnd->run_usec);
+	print_stall("ACK stalls", rnd->ack_usec, rnd->run_usec);
+}
+
+int main(int argc, char** argv) {
+	const char* path = "otp_bench.img";
+	NandSimConfig config = nand_sim_default_config();
+	uint16_t block_count = 2048;
+	bool fresh = false;
+	bool is_A = true;
+	bool reset = true;
+	uint16_t bad_blocks = 0;
+	uint32_t searches = 100, provisions = 64, retrievals = 64;
+	uint32_t i;
+	uint32_t interrupt_ms = 0;
+	uint32_t para_code;
+	OTPConfig header;
+	int opt;
+
+	sim_board.rng_byte = 0;
+	sim_board.uart_byte = 21667;
+	sim_board.crc_byte = 1250;
+	while ((opt = getopt(argc, argv, "b:fB:e:r:p:E:t:c:C:k:n:g:u:i:s:P:R:Axv")) != -1) {
+		switch (opt) {
+		case 'b': block_count = atoi(optarg); break;
+		case 'f': fresh = true; break;
+		case 'B': bad_blocks = atoi(optarg); break;
+		case 'e': config.bit_error_rate = atof(optarg); break;
+		case 'r': config.t_r = atoi(optarg); break;
+		case 'p': config.t_prog = atoi(optarg); break;
+		case 'E': config.t_bers = atoi(optarg); break;
+		case 't': config.t_byte = atoi(optarg); break;
+		case 'c': config.t_secded = atoi(optarg); break;
+		case 'C': config.t_bch = atoi(optarg); break;
+		case 'k': sim_board.crc_byte = atoi(optarg); break;
+		case 'n': config.nop = atoi(optarg); break;
+		case 'g': sim_board.rng_byte = atoi(optarg); break;
+		case 'u': sim_board.uart_byte = atoi(optarg); break;
+		case 'i': interrupt_ms = atoi(optarg); break;
+		case 's': searches = atoi(optarg); break;
+		case 'P': provisions = atoi(optarg); break;
+		case 'R': retrievals = atoi(optarg); break;
+		case 'A': is_A = false; break;
+		case 'x': reset = false; break;
+		case 'v': sim_verbose = true; break;
+		default: usage();
+		}
+	}
+	if (optind < argc) path = argv[optind];
+	// the twin writes a fresh pad with the code config.h selects
+#ifdef ECC_BCH
+	para_code = config.t_bch;
+#else
+	para_code = config.t_secded;
+#endif
+	if (para_code < config.t_byte) para_code = config.t_byte;
+	sim_board.twin_para = (uint32_t)PARA_SIZE * para_code + PARA_SPARE_SIZE * config.t_byte;
+	sim_board.twin_erase = config.t_bers;
+	sim_board.twin_checksum = PAGE_COUNT * (config.t_r + 4 * (sim_board.twin_para + PARA_SIZE * sim_board.crc_byte));
+	if (!nand_sim_open(path, block_count, fresh, &config)) {
+		fprintf(stderr, "Can't open a %u block image at %s\n", block_count, path);
+		return 1;
+	}
+	srand(1);
+	srand48(1);
+	buffers_init();
+	nand_init();
+
+	header = otp_read_header();
+	if (!header.has_header || !header.randomization_finished) {
+		for (i = 0; i < bad_blocks; i++) {
+			nand_sim_mark_bad(1 + rand() % (block_count - 1));
+		}
+		begin_phase();
+		otp_initialize_header(is_A);
+		end_phase("otp_initialize_header", 1);
+		begin_phase();
+		if (interrupt_ms != 0) {
+			sim_board.power_fail_at = phase_start + (uint64_t)interrupt_ms * 1000000;
+			if (setjmp(sim_power_fail) != 0) {
+				end_phase("otp_randomize_boards (power lost)", 1);
+				sim_power_cycle();
+				buffers_init();
+				nand_init();
+				otp_load_metadata();
+				begin_phase();
+			}
+		}
+		otp_randomize_boards();
+		end_phase("otp_randomize_boards", 1);
+		print_randomize_stats();
+	}
+
+	begin_phase();
+	for (i = 0; i < searches; i++) {
+		otp_find_unmarked_block(i & 1);
+	}
+	end_phase("otp_find_unmarked_block", searches);
+
+	begin_phase();
+	for (i = 0; i < provisions; i++) {
+		otp_provision(1, is_A);
+	}
+	end_phase("otp_provision", provisions);
+
+	begin_phase();
+	for (i = 0; i < retrievals; i++) {
+		otp_retrieve(nand_page_number(1 + rand() % (block_count - 1), rand() % PAGE_COUNT));
+	}
+	end_phase("otp_retrieve", retrievals);
+
+	if (reset) {
+		begin_phase();
+		otp_factory_reset();
+		end_phase("otp_factory_reset", 1);
+	}
+
+	nand_sim_close();
+	return 0;
+}
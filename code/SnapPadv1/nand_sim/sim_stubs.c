@@ -0,0 +1,418 @@
+/*
+ * sim_stubs.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: phooky
+ */
+
+#include "nand_sim.h"
+#include "nand.h"
+#include "leds.h"
+#include "hwrng.h"
+#include "uarts.h"
+#include "print.h"
+#include "onetimepad.h"
+#include "timer.h"
+#include "crc32.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+bool sim_verbose = false;
+
+/**
+ * LEDs
+ */
+
+void leds_set_led(uint8_t led, uint8_t mode) {}
+void leds_set_mode(uint8_t mode) {}
+
+SimBoardConfig sim_board;
+jmp_buf sim_power_fail;
+
+static uint64_t sim_now() {
+	return nand_sim_get_stats()->time_ns;
+}
+
+static uint64_t rng_ready_at;		// the RNG finishes its fill
+static uint64_t uart_done_at;		// the UART finishes sending
+
+#define TWIN_QUEUE_LEN 2048
+
+/** Bytes from the twin, each with the time its last bit arrives. */
+static uint8_t twin_queue[TWIN_QUEUE_LEN];
+static uint64_t twin_queue_at[TWIN_QUEUE_LEN];
+static uint16_t twin_head, twin_tail;
+static uint32_t rx_overruns;
+
+/** A poll that finds its stage busy costs a microsecond of device time, as a
+	turn of the firmware's wait loop would. */
+static void poll_wait() {
+	nand_sim_advance(sim_now() + 1000);
+}
+
+uint16_t timer_usec() {
+	return (sim_now() / 1000) & 0xffff;
+}
+
+/**
+ * CRC-32: the board's CPU takes its time over a buffer, then has the CRC.
+ */
+
+uint32_t __real_crc32_update(uint32_t crc, const uint8_t* data, uint16_t count);
+
+uint32_t __wrap_crc32_update(uint32_t crc, const uint8_t* data, uint16_t count) {
+	nand_sim_advance(sim_now() + (uint64_t)count * sim_board.crc_byte);
+	return __real_crc32_update(crc, data, count);
+}
+
+/**
+ * RNG: the buffer is filled at once, but isn't done until its time has passed.
+ */
+
+void hwrng_bits_start(uint8_t* ptr, uint16_t len) {
+	rng_ready_at = sim_now() + (uint64_t)len * sim_board.rng_byte;
+	while (len--) *(ptr++) = rand() & 0xff;
+}
+
+bool hwrng_bits_done() {
+	if (sim_now() < rng_ready_at) poll_wait();
+	return sim_now() >= rng_ready_at;
+}
+
+/**
+ * UART: a twin that parses the tokens it is sent and queues its replies. The twin
+ * reads what it receives out of a 64-byte ring, as uarts.c does, and can't while it
+ * is loading or erasing its chip; bytes that arrive with the ring full are lost.
+ * The board under test reads the twin's bytes out of a ring of the same size.
+ *
+ * In a split randomization the twin generates its half of each page, and sends it
+ * once it has loaded the last exchange and heard the master is ready, as
+ * otp_randomize_split does.
+ */
+
+#define TWIN_RING_LEN 64
+
+static uint32_t twin_crcs[1 << MAX_BLOCK_BITS];
+static uint8_t twin_token;		// token being received, or 0
+static uint16_t twin_count;		// bytes of the token received so far
+static uint16_t twin_block;
+static uint8_t twin_page, twin_para;
+static uint64_t twin_free_at;	// the twin is done with the last token it received
+static uint64_t twin_tx_at;		// the twin's UART finishes sending
+static uint16_t twin_backlog;	// bytes waiting in its ring
+static uint32_t twin_overruns;
+static uint16_t twin_progress;	// the last randomization checkpoint the twin recorded
+static bool twin_finished;		// the twin has set its randomization finished flag
+static uint16_t split_step;		// the step the twin is randomizing in a split randomization
+static uint16_t split_slot;		// exchanges of the step done
+static uint8_t split_sums;		// block CRCs of the step received from the master
+static uint8_t split_own[PARA_SIZE];	// the paragraph the twin sent in the current exchange
+static uint8_t split_page[4][PARA_SIZE];	// the page being exchanged, for the read-back CRC
+static uint32_t split_readback[1 << MAX_BLOCK_BITS];	// CRCs of the blocks' data in page order
+static uint64_t split_rng_at;	// the twin's RNG finishes filling its next paragraph
+
+uint32_t sim_take_twin_overruns() {
+	uint32_t count = twin_overruns;
+	twin_overruns = 0;
+	return count;
+}
+
+uint32_t sim_take_rx_overruns() {
+	uint32_t count = rx_overruns;
+	rx_overruns = 0;
+	return count;
+}
+
+static uint64_t later(uint64_t a, uint64_t b) {
+	return (a > b)?a:b;
+}
+
+/** The twin sends bytes from the given time, or once it's done with the last send. */
+static void twin_send(uint64_t start, const uint8_t* data, uint16_t len) {
+	uint16_t i;
+	start = later(start, twin_tx_at);
+	for (i = 0; i < len; i++) {
+		twin_queue[twin_tail] = data[i];
+		twin_queue_at[twin_tail] = start + (uint64_t)(i + 1) * sim_board.uart_byte;
+		twin_tail = (twin_tail + 1) % TWIN_QUEUE_LEN;
+	}
+	twin_tx_at = start + (uint64_t)len * sim_board.uart_byte;
+}
+
+/**
+ * Finish a token at the time its last byte arrived: the twin spends busy_ns on it,
+ * then sends its reply.
+ */
+static void twin_finish(uint64_t at, uint32_t busy_ns, const uint8_t* reply, uint8_t len) {
+	twin_free_at = later(at, twin_free_at) + busy_ns;
+	twin_send(twin_free_at, reply, len);
+	twin_token = 0;
+}
+
+/**
+ * Split randomization
+ */
+
+/** Get the block of the twin's current exchange; see otp_randomize_split. */
+static uint16_t split_block() {
+	if (split_step == 0) return otp_plane_partner(0);
+	return ((split_slot / 2) % 2 == 0)?split_step:otp_plane_partner(split_step);
+}
+
+/** Send the twin's next paragraph from the given time, once its RNG has filled it. */
+static void split_send(uint64_t start) {
+	uint8_t token = UTOK_SPLIT_DATA;
+	uint16_t i;
+	start = later(later(start, twin_tx_at), split_rng_at);
+	// the RNG starts on the one after
+	split_rng_at = start + (uint64_t)PARA_SIZE * sim_board.rng_byte;
+	for (i = 0; i < PARA_SIZE; i++) split_own[i] = rand() & 0xff;
+	twin_send(start, &token, 1);
+	twin_send(start, split_own, PARA_SIZE);
+}
+
+/** The twin erases the blocks of its next step, then says it's ready. */
+static void split_begin_step(uint64_t at) {
+	const uint8_t reply = UTOK_SPLIT_READY;
+	twin_crcs[split_step] = twin_crcs[otp_plane_partner(split_step)] = CRC32_INIT;
+	split_readback[split_step] = split_readback[otp_plane_partner(split_step)] = CRC32_INIT;
+	split_slot = 0;
+	split_sums = 0;
+	twin_finish(at, sim_board.twin_erase, &reply, 1);
+}
+
+/** The twin has the master's paragraph of the current exchange. */
+static void split_exchanged(uint64_t at) {
+	const uint16_t block = split_block();
+	const uint8_t half = split_slot % 2;
+	uint8_t i;
+	// the twin loads both paragraphs once its own is sent
+	twin_crcs[block] = __real_crc32_update(twin_crcs[block], split_own, PARA_SIZE);
+	memcpy(split_page[half + 2], split_own, PARA_SIZE);
+	if (half == 1) {
+		for (i = 0; i < 4; i++) split_readback[block] = __real_crc32_update(split_readback[block], split_page[i], PARA_SIZE);
+	}
+	twin_free_at = later(later(at, twin_tx_at), twin_free_at) +
+			2 * (sim_board.twin_para + (uint64_t)PARA_SIZE * sim_board.crc_byte);
+	twin_token = 0;
+	if (++split_slot < PAGE_COUNT * ((split_step == 0)?2:4)) {
+		// the twin sends its paragraph when the master says it's ready too
+		const uint8_t reply = UTOK_SPLIT_READY;
+		twin_send(twin_free_at, &reply, 1);
+		return;
+	}
+	// swap the CRCs of the step's blocks
+	for (i = (split_step == 0)?1:0; i < 2; i++) {
+		const uint16_t sum_block = (i == 0)?split_step:otp_plane_partner(split_step);
+#ifdef OTP_READBACK_VERIFY
+		const uint32_t crc = crc32_finish(split_readback[sum_block]);
+#else
+		const uint32_t crc = crc32_finish(twin_crcs[sum_block]);
+#endif
+		const uint8_t reply[5] = { UTOK_RSP_CHKSM, crc >> 24, crc >> 16, crc >> 8, crc };
+#ifdef OTP_READBACK_VERIFY
+		twin_free_at += sim_board.twin_checksum;
+#endif
+		twin_send(twin_free_at, reply, 5);
+	}
+}
+
+/** The twin has one of the master's block CRCs for the step. */
+static void split_summed(uint64_t at) {
+	twin_token = 0;
+	if (++split_sums < ((split_step == 0)?1:2)) return;
+	// the twin checkpoints every step, more often than the master does
+	twin_progress = ++split_step;
+	if (split_step < nand_geometry.plane_blocks) {
+		split_begin_step(at);
+	} else {
+		twin_finished = true;
+	}
+}
+
+/** The twin receives a byte at the given time. */
+static void twin_receive(uint8_t b, uint64_t at) {
+	if (at < twin_free_at) {
+		if (++twin_backlog > TWIN_RING_LEN) twin_overruns++;
+	} else {
+		twin_backlog = 0;
+	}
+	if (twin_token == 0) {
+		twin_token = b;
+		twin_count = 0;
+		if (b == UTOK_REQ_PROGRESS) {
+			const uint16_t next = twin_finished?0:twin_progress;
+			const uint8_t reply[3] = { UTOK_RSP_PROGRESS, next >> 8, next };
+			twin_finish(at, 0, reply, 3);
+		} else if (b == UTOK_SPLIT_READY) {
+			// both are ready; the twin starts on the next exchange
+			twin_token = 0;
+			split_send(later(at, twin_free_at));
+		} else if (b == UTOK_RSP_CHKSM_BAD) {
+			split_summed(at);
+		}
+		return;
+	}
+	twin_count++;
+	if (twin_count == 1) twin_block = b << 8;
+	if (twin_count == 2) twin_block |= b;
+	if (twin_count == 3) twin_page = b;
+	if (twin_count == 4) twin_para = b;
+	switch (twin_token) {
+	case UTOK_BEGIN_DATA:
+		// block, page and paragraph, then the data
+		if (twin_count == 5 && twin_page == 0 && twin_para == 0) twin_crcs[twin_block] = CRC32_INIT;
+		if (twin_count > 4) twin_crcs[twin_block] = crc32_byte(twin_crcs[twin_block], b);
+		if (twin_count == 4 + PARA_SIZE) {
+			const uint8_t reply = UTOK_DATA_ACK;
+			uint32_t busy = sim_board.twin_para;
+			// the first paragraph of a pair, or of the header's partner, erases
+			if (twin_page == 0 && twin_para == 0 &&
+					(twin_block < nand_geometry.plane_blocks || otp_plane_partner(twin_block) == 0)) {
+				busy += sim_board.twin_erase;
+			}
+			if (twin_block == nand_geometry.block_count-1 && twin_page == PAGE_COUNT-1 && twin_para == 3) {
+				twin_finished = true;
+			}
+			twin_finish(at, busy, &reply, 1);
+		}
+		break;
+	case UTOK_REQ_CHKSM:
+		if (twin_count == 2) {
+			const uint32_t crc = crc32_finish(twin_crcs[twin_block]);
+			const uint8_t reply[5] = { UTOK_RSP_CHKSM, crc >> 24, crc >> 16, crc >> 8, crc };
+			// the twin only reads the block back with OTP_READBACK_VERIFY
+#ifdef OTP_READBACK_VERIFY
+			twin_finish(at, sim_board.twin_checksum, reply, 5);
+#else
+			twin_finish(at, 0, reply, 5);
+#endif
+		}
+		break;
+	case UTOK_BEGIN_SPLIT:
+		if (twin_count == 2) {
+			split_step = twin_block;
+			split_rng_at = at + (uint64_t)PARA_SIZE * sim_board.rng_byte;
+			split_begin_step(at);
+		}
+		break;
+	case UTOK_SPLIT_DATA:
+		twin_crcs[split_block()] = crc32_byte(twin_crcs[split_block()], b);
+		split_page[split_slot % 2][twin_count - 1] = b;
+		if (twin_count == PARA_SIZE) split_exchanged(at);
+		break;
+	case UTOK_RSP_CHKSM:
+		if (twin_count == 4) split_summed(at);
+		break;
+	case UTOK_CHECKPOINT:
+		if (twin_count == 2) {
+			const uint8_t reply = UTOK_CHECKPOINT_ACK;
+			twin_progress = twin_block;
+			twin_finish(at, 0, &reply, 1);
+		}
+		break;
+	case UTOK_MARK_BLOCK:
+		if (twin_count == 2) {
+			const uint8_t reply = UTOK_MARK_ACK;
+			twin_finish(at, 0, &reply, 1);
+		}
+		break;
+	default:
+		twin_token = 0;
+	}
+}
+
+void uart_send_buffer(uint8_t* buffer, uint16_t len) {
+	uint64_t at;
+	uint16_t i;
+	// wait for the last send
+	nand_sim_advance(uart_done_at);
+	if (sim_board.power_fail_at != 0 && sim_now() >= sim_board.power_fail_at) {
+		sim_board.power_fail_at = 0;
+		longjmp(sim_power_fail, 1);
+	}
+	at = sim_now();
+	for (i = 0; i < len; i++) {
+		at += sim_board.uart_byte;
+		twin_receive(buffer[i], at);
+	}
+	uart_done_at = at;
+}
+
+void uart_send_byte(uint8_t b) {
+	uart_send_buffer(&b, 1);
+}
+
+bool uart_send_complete() {
+	if (sim_now() < uart_done_at) poll_wait();
+	return sim_now() >= uart_done_at;
+}
+
+void sim_power_cycle() {
+	twin_token = 0;
+	twin_head = twin_tail = 0;
+	twin_free_at = twin_tx_at = rng_ready_at = uart_done_at = sim_now();
+	twin_backlog = 0;
+	nand_sim_power_cycle();
+}
+
+bool uart_has_data() {
+	return twin_head != twin_tail && twin_queue_at[twin_head] <= sim_now();
+}
+
+uint8_t uart_consume() {
+	uint8_t b;
+	uint16_t i, waiting = 0;
+	if (twin_head == twin_tail) return 0;
+	nand_sim_advance(twin_queue_at[twin_head]);
+	// count the bytes in the receive ring
+	for (i = twin_head; i != twin_tail && waiting <= TWIN_RING_LEN; i = (i + 1) % TWIN_QUEUE_LEN) {
+		if (twin_queue_at[i] > sim_now()) break;
+		waiting++;
+	}
+	if (waiting > TWIN_RING_LEN) rx_overruns++;
+	b = twin_queue[twin_head];
+	twin_head = (twin_head + 1) % TWIN_QUEUE_LEN;
+	return b;
+}
+
+/**
+ * USB output
+ */
+
+static uint32_t pad_bytes;
+
+uint32_t sim_take_pad_bytes() {
+	uint32_t count = pad_bytes;
+	pad_bytes = 0;
+	return count;
+}
+
+void print_usb_dec(uint32_t i) {
+	if (sim_verbose) printf("%u", i);
+}
+
+char hex(uint8_t v) {
+	return "0123456789abcdef"[v & 0x0f];
+}
+
+void print_usb_hex(const uint8_t i) {
+	if (sim_verbose) printf("%02x", i);
+}
+
+void print_usb_str(const char* s) {
+	if (sim_verbose) fputs(s, stdout);
+}
+
+void print_usb_base64(uint8_t* buf, uint16_t sz) {
+	pad_bytes += sz;
+}
+
+void b64_print_init() {}
+
+void b64_print_buffer(uint8_t* buf, uint16_t sz) {
+	pad_bytes += sz;
+}
+
+void b64_print_finish() {}
@@ -3,9 +3,13 @@
 #include "config.h"
 #include "leds.h"
 #include "buffers.h"
+#include "crc32.h"
 #include "hwrng.h"
 #include "uarts.h"
 #include "print.h"
+#ifdef NAND_STATS
+#include "timer.h"
+#endif
 
 #define MAGIC_LEN 8
 const uint8_t MAGIC[MAGIC_LEN] = { 'S','N','A','P','-','P','A','D' };
@@ -14,9 +18,80 @@ const uint8_t MAGIC[MAGIC_LEN] = { 'S','N','A','P','-','P','A','D' };
 
 // Block usage page
 #define BLOCK_USAGE_PAGE 4
+/** The usage map holds one byte per block. The first 2048 entries fill the
+	block usage page; chips with more blocks continue the map on the pages
+	from BLOCK_USAGE_EXT_PAGE on. */
+#define USAGE_PAGE_BITS 11
+#define BLOCK_USAGE_EXT_PAGE 6
 
 #define FLAGS_PAGE 5
 
+/** The cursor journal records where provisioning has got to, so that it can
+	resume without scanning for the first free block and page. An entry is
+	appended each time provisioning moves to a new block. Each entry has a
+	paragraph of its own, so each journal page takes no more than the four
+	partial programs the chip allows between erases.
+
+	Before provisioning starts, the same journal records how far randomization
+	has got (see otp_checkpoint_randomize), in entries whose page is
+	PROGRESS_MARK.
+
+	The partial program limit keeps the journal to JOURNAL_SLOTS entries, so
+	it covers the first 160 or more blocks of a half (JOURNAL_SLOTS less
+	PROGRESS_CHECKPOINTS), not all of it. Once it is full nothing more is
+	appended, and after a restart provisioning takes up its cursor from the
+	usage map instead, which marks each block provisioning leaves, in order:
+	the first unmarked block of the half, found in the RAM bitmap, and its
+	first free page, found with a binary search. */
+#define JOURNAL_FIRST_PAGE 8
+#define JOURNAL_SLOTS ((PAGE_COUNT - JOURNAL_FIRST_PAGE) * 4)
+#define PROGRESS_MARK 0xfe
+/** Randomization checkpoints at most this many times, so that the journal keeps
+	most of its slots for provisioning. */
+#define PROGRESS_CHECKPOINTS 64
+
+typedef struct {
+	uint16_t block;
+	uint8_t page;
+	uint8_t check;
+} CursorEntry;
+
+/**
+ * Get the address of a block's entry in the usage map.
+ */
+static uint32_t usage_addr(uint16_t block) {
+	const uint16_t page = block >> USAGE_PAGE_BITS;
+	return nand_make_addr(0,(page == 0)?BLOCK_USAGE_PAGE:(BLOCK_USAGE_EXT_PAGE + page - 1),
+			block & ((1 << USAGE_PAGE_BITS) - 1));
+}
+
+/** The usage map is kept in RAM as one bit per block, set while the block is
+	unused. It is sized for the largest supported chip. */
+#define USAGE_BITMAP_BYTES ((1 << MAX_BLOCK_BITS) / 8)
+/** Usage map entries are read from the chip this many at a time. */
+#define USAGE_CHUNK 64
+
+/** RAM copy of the metadata in block 0 (see otp_load_metadata). */
+static struct {
+	bool loaded;
+	OTPConfig config;
+	uint8_t bad_block_count;
+	uint16_t bad_blocks[BBL_MAX_ENTRIES];
+	uint8_t unused[USAGE_BITMAP_BYTES];
+	bool cursor_valid;
+	CursorEntry cursor;			// the last page provisioned
+	uint16_t journal_block;		// the block of the last journal entry
+	uint16_t journal_next;		// the first empty journal slot
+	uint16_t randomize_next;	// the first randomization step not checkpointed
+#ifdef OTP_DEFERRED_ERASE
+	uint16_t erase_pending;		// a consumed block still to be erased, or 0xffff
+#endif
+} metadata;
+
+static bool is_block_unused(uint16_t block) {
+	return (metadata.unused[block >> 3] & (1 << (block & 7))) != 0;
+}
+
 typedef struct {
 	uint8_t header_written : 2;
 	uint8_t random_data_started : 2;
@@ -70,7 +145,7 @@ void mark_bad_block(uint32_t block) {
 uint8_t otp_scan_bad_blocks(uint16_t* bad_block_list, uint8_t block_list_len) {
 	uint16_t block;
 	uint8_t bbl_idx = 0;
-	for (block = 0; block < BLOCK_COUNT; block++) {
+	for (block = 0; block < nand_geometry.block_count; block++) {
 		if (check_bad_block(block)) {
 			bad_block_list[bbl_idx++] = block;
 			if (bbl_idx >= block_list_len) return bbl_idx;
@@ -94,9 +169,10 @@ void otp_factory_reset() {
 	} else {
 		bbcount = otp_scan_bad_blocks(bbl, BBL_MAX_ENTRIES);
 	}
-	for (block = 0; block < BLOCK_COUNT; block++) {
-		nand_block_erase(block);
+	for (block = 0; block < nand_geometry.plane_blocks; block++) {
+		nand_block_erase_planes(block);
 	}
+	metadata.loaded = false;
 	for (bbidx = 0; bbidx < bbcount; bbidx++) {
 		mark_bad_block(bbl[bbidx]);
 	}
@@ -109,12 +185,12 @@ void otp_factory_reset() {
  * @return the number of bad blocks loaded
  */
 uint8_t otp_fetch_bad_blocks(uint16_t* bad_block_list, uint8_t block_list_len) {
-	uint32_t addr = nand_make_addr(0,0,BBL_START);
-	nand_read_raw_page(addr,(uint8_t*)bad_block_list,block_list_len*2);
 	uint8_t i;
-	for (i = 0; i < block_list_len; i++) {
-		if (bad_block_list[i] == 0xFFFF) { return i; }
+	if (!metadata.loaded) otp_load_metadata();
+	for (i = 0; i < metadata.bad_block_count && i < block_list_len; i++) {
+		bad_block_list[i] = metadata.bad_blocks[i];
 	}
+	if (i < block_list_len) bad_block_list[i] = 0xFFFF;
 	return i;
 }
 
@@ -144,7 +220,19 @@ bool otp_write_bad_blocks(uint16_t* bad_block_list, uint8_t bad_block_count) {
  *  0x0C: A/B select (1B)
  *  0x0D: reserved (3B)
  *  0x10: bad block list (32B, 16 16-bit entries, terminated by 0xff)
+ *
+ * The header paragraph itself is always protected by SEC-DED. Pads with a
+ * header version of 1.2 or later protect every other paragraph with BCH.
  */
+#define BCH_MAJOR_VERSION 1
+#define BCH_MINOR_VERSION 2
+
+#ifdef ECC_BCH
+	#define PAD_MINOR_VERSION MINOR_VERSION
+#else
+	#define PAD_MINOR_VERSION 1
+#endif
+
 typedef struct {
 	uint8_t magic[MAGIC_LEN];
 	uint8_t major_version;
@@ -154,27 +242,185 @@ typedef struct {
 } OTPHeader;
 
 
-OTPConfig otp_read_header() {
-	OTPConfig config;
-	config.has_header = false;
+/**
+ * Read the usage map into the bitmap, with one array read per usage page.
+ * @return true if more than one consumed block was found (OTP_DEFERRED_ERASE)
+ */
+static bool scan_usage_map() {
+	uint8_t chunk[USAGE_CHUNK];
+	uint16_t block;
+	uint8_t i;
+	bool more = false;
+#ifdef OTP_DEFERRED_ERASE
+	metadata.erase_pending = 0xffff;
+#endif
+	for (block = 0; block < nand_geometry.block_count; block += USAGE_CHUNK) {
+		if ((block & ((1 << USAGE_PAGE_BITS) - 1)) == 0) {
+			nand_read_raw_page(usage_addr(block),chunk,USAGE_CHUNK);
+		} else {
+			nand_recv_data(chunk,USAGE_CHUNK);
+		}
+		for (i = 0; i < USAGE_CHUNK; i++) {
+			uint8_t* bits = &metadata.unused[(block + i) >> 3];
+			if (chunk[i] == BU_UNUSED_BLOCK) {
+				*bits |= 1 << (i & 7);
+			} else {
+				*bits &= ~(1 << (i & 7));
+			}
+#ifdef OTP_DEFERRED_ERASE
+			// an erase cut short by a power loss
+			if (chunk[i] == BU_CONSUMED_BLOCK && block + i < nand_geometry.block_count) {
+				if (metadata.erase_pending == 0xffff) {
+					metadata.erase_pending = block + i;
+				} else {
+					more = true;
+				}
+			}
+#endif
+		}
+	}
+	return more;
+}
+
+/**
+ * Load the usage map. Only one consumed block is left to be erased while a
+ * page is released; any others are erased here, one per scan of the map.
+ */
+static void load_usage_map() {
+	while (scan_usage_map()) {
+#ifdef OTP_DEFERRED_ERASE
+		nand_block_erase(metadata.erase_pending);
+		otp_mark_block(metadata.erase_pending,BU_USED_BLOCK);
+#endif
+	}
+}
+
+static uint32_t journal_addr(uint16_t slot) {
+	return nand_make_para_addr(0,JOURNAL_FIRST_PAGE + (slot >> 2),slot & 3);
+}
+
+static uint8_t cursor_check(uint16_t block, uint8_t page) {
+	return (block >> 8) ^ (block & 0xff) ^ page ^ 0x5a;
+}
+
+/**
+ * Find the end of the cursor journal with a binary search, and take the cursor from
+ * its last entry. A journal whose last entry fails its check, or names a block that
+ * is no longer unused, leaves the cursor invalid; so does one that ends with a
+ * randomization checkpoint, which is taken as the randomization progress instead.
+ * A full journal is not corrupt: its last entry names the block provisioning had
+ * reached when it filled, and once that block is marked the cursor is taken up from
+ * the usage map (see otp_provision_one).
+ */
+static void load_journal() {
+	CursorEntry entry;
+	uint16_t lo = 0, hi = JOURNAL_SLOTS;
+	while (lo < hi) {
+		const uint16_t mid = (lo + hi) / 2;
+		nand_read_raw_page(journal_addr(mid),(uint8_t*)&entry,sizeof(entry));
+		if (entry.block == 0xffff && entry.page == 0xff && entry.check == 0xff) {
+			hi = mid;
+		} else {
+			lo = mid + 1;
+		}
+	}
+	metadata.journal_next = lo;
+	metadata.journal_block = 0xffff;
+	metadata.cursor_valid = false;
+	metadata.randomize_next = 0;
+	if (lo == 0) return;
+	nand_read_raw_page(journal_addr(lo - 1),(uint8_t*)&entry,sizeof(entry));
+	if (entry.check != cursor_check(entry.block,entry.page)) return;
+	if (entry.page == PROGRESS_MARK) {
+		if (entry.block <= nand_geometry.plane_blocks) metadata.randomize_next = entry.block;
+		return;
+	}
+	if (entry.block == 0 || entry.block >= nand_geometry.block_count) return;
+	if (entry.page >= PAGE_COUNT || !is_block_unused(entry.block)) return;
+	metadata.cursor = entry;
+	metadata.cursor_valid = true;
+	metadata.journal_block = entry.block;
+}
+
+/**
+ * Move the cursor to a freshly provisioned page, journaling it if it starts a new block
+ * and the journal has room.
+ */
+static void advance_cursor(uint16_t block, uint8_t page) {
+	metadata.cursor.block = block;
+	metadata.cursor.page = page;
+	metadata.cursor.check = cursor_check(block,page);
+	metadata.cursor_valid = true;
+	if (block != metadata.journal_block && metadata.journal_next < JOURNAL_SLOTS) {
+		nand_program_raw_page(journal_addr(metadata.journal_next),(uint8_t*)&metadata.cursor,sizeof(CursorEntry));
+		nand_wait_for_ready();
+		metadata.journal_next++;
+		metadata.journal_block = block;
+	}
+}
+
+void otp_checkpoint_randomize(uint16_t next) {
+	CursorEntry entry;
+	if (!metadata.loaded) otp_load_metadata();
+	if (metadata.journal_next >= JOURNAL_SLOTS) return;
+	entry.block = next;
+	entry.page = PROGRESS_MARK;
+	entry.check = cursor_check(next,PROGRESS_MARK);
+	nand_program_raw_page(journal_addr(metadata.journal_next),(uint8_t*)&entry,sizeof(CursorEntry));
+	nand_wait_for_ready();
+	metadata.journal_next++;
+	metadata.randomize_next = next;
+}
+
+uint16_t otp_randomize_progress() {
+	if (!metadata.loaded) otp_read_header();
+	// a finished pad is randomized again from the start, not from its last checkpoint
+	if (!metadata.config.randomization_started || metadata.config.randomization_finished) return 0;
+	return metadata.randomize_next;
+}
+
+void otp_load_metadata() {
+	OTPConfig* config = &metadata.config;
 	OTPHeader* header;
 	uint8_t i;
+	config->has_header = true;
+	config->randomization_started = false;
+	config->randomization_finished = false;
+	metadata.bad_block_count = 0;
+	nand_set_ecc_mode(NAND_ECC_SECDED);
 	nand_load_para(0,0,0);
 	header = (OTPHeader*)nand_para_buffer();
 	for (i = 0; i < MAGIC_LEN; i++) {
-		if (header->magic[i] != MAGIC[i]) return config; // no header found
+		if (header->magic[i] != MAGIC[i]) config->has_header = false; // no header found
 	}
-	config.has_header = true;
-	config.major_version = header->major_version;
-	config.minor_version = header->minor_version;
-	config.block_count = header->block_count;
-	config.is_A = header->is_A != 0x00;
+	if (config->has_header) {
+		const uint16_t* bbl = (const uint16_t*)(nand_para_buffer() + BBL_START);
+		OTPFlags flags;
+		config->major_version = header->major_version;
+		config->minor_version = header->minor_version;
+		config->block_count = header->block_count;
+		config->is_A = header->is_A != 0x00;
+		while (metadata.bad_block_count < BBL_MAX_ENTRIES && bbl[metadata.bad_block_count] != 0xFFFF) {
+			metadata.bad_blocks[metadata.bad_block_count] = bbl[metadata.bad_block_count];
+			metadata.bad_block_count++;
+		}
+		nand_read_raw_page(nand_make_addr(0,FLAGS_PAGE,0),(uint8_t*)&flags,sizeof(flags));
+		config->randomization_started = flags.random_data_started != 0x03;
+		config->randomization_finished = flags.random_data_written != 0x03;
+	}
+	// the header is read with SEC-DED; the rest of the pad with the code it was written with
+	if (config->has_header && (config->major_version > BCH_MAJOR_VERSION ||
+			(config->major_version == BCH_MAJOR_VERSION && config->minor_version >= BCH_MINOR_VERSION))) {
+		nand_set_ecc_mode(NAND_ECC_BCH);
+	}
+	load_usage_map();
+	load_journal();
+	metadata.loaded = true;
+}
 
-	OTPFlags flags;
-	nand_read_raw_page(nand_make_addr(0,FLAGS_PAGE,0),(uint8_t*)&flags,sizeof(flags));
-	config.randomization_started = flags.random_data_started != 0x03;
-	config.randomization_finished = flags.random_data_written != 0x03;
-	return config;
+OTPConfig otp_read_header() {
+	if (!metadata.loaded) otp_load_metadata();
+	return metadata.config;
 }
 
 /** Initialize the header block. If there's already one, erase block zero and recreate the
@@ -202,6 +448,7 @@ bool otp_initialize_header(bool is_A) {
 	print_usb_str("got bbl\n");
 	// Erase block 0
 	nand_block_erase(0);
+	metadata.loaded = false;
 	print_usb_str("erased block 0\n");
 	// Create and write header, version, bbl
 	nand_initialize_para_buffer();
@@ -210,8 +457,8 @@ bool otp_initialize_header(bool is_A) {
 		header->magic[i] = MAGIC[i];
 	}
 	header->major_version = MAJOR_VERSION;
-	header->minor_version = MINOR_VERSION;
-	header->block_count = BLOCK_COUNT - (1 + bbcount);
+	header->minor_version = PAD_MINOR_VERSION;
+	header->block_count = nand_geometry.block_count - (1 + bbcount);
 	header->is_A = is_A?0xff:0x00;
 	print_usb_str("prepared header\n");
 	uint16_t* bbl_target = (uint16_t*)(nand_para_buffer() + BBL_START);
@@ -220,11 +467,15 @@ bool otp_initialize_header(bool is_A) {
 	}
 	print_usb_str("prepared bbl\n");
 	// write header page
+	nand_set_ecc_mode(NAND_ECC_SECDED);
 	bool write_succ = nand_save_para(0,0,0);
 	print_usb_str("wrote paragraph 0\n");
 	nand_wait_for_ready();
 
 	if (!write_succ) return false;
+#ifdef ECC_BCH
+	nand_set_ecc_mode(NAND_ECC_BCH);
+#endif
 	// write header confirmation bits
 	otp_set_flag(FLAG_HEADER_WRITTEN);
 
@@ -232,124 +483,610 @@ bool otp_initialize_header(bool is_A) {
 	return true;
 }
 
+uint16_t otp_plane_partner(uint16_t block) {
+	return block ^ nand_geometry.plane_blocks;
+}
+
+#ifdef NAND_STATS
+static RandomizeStats rnd_stats;
+
+const RandomizeStats* otp_get_randomize_stats() {
+	return &rnd_stats;
+}
+#define STAT_START(t) t = timer_usec()
+#define STAT_ADD(field,t) rnd_stats.field += (uint16_t)(timer_usec() - t)
+#else
+#define STAT_START(t)
+#define STAT_ADD(field,t)
+#endif
+
 /**
- * Run complete randomization process. Can take up to four hours to complete.
+ * Ask the twin how far its last randomization got, and agree to resume from
+ * whichever of the two boards has checkpointed less.
+ * @return the first randomization step (the plane 0 block) to run
  */
-bool otp_randomize_boards() {
-	uint16_t block;
-	hwrng_bits_start(buffers_get_rng(),512);
+static uint16_t otp_agree_resume() {
+	uint16_t local = otp_randomize_progress();
+	uint16_t remote;
+	uart_send_byte(UTOK_REQ_PROGRESS);
+	if (uart_consume() != UTOK_RSP_PROGRESS) {
+		print_usb_str("BAD PROGRESS RSP\n");
+		return 0;
+	}
+	remote = uart_consume() << 8;
+	remote |= uart_consume();
+	if (remote < local) local = remote;
 	print_usb_str("BEGIN RND\n");
+	if (local != 0) {
+		print_usb_str("RESUME AT ");
+		print_usb_dec(local);
+		print_usb_str("\n");
+	}
+	return local;
+}
+
+#ifndef OTP_SPLIT_RANDOMIZE
+/** Bytes of the next paragraph, its token and address included, that may be sent
+	before the twin has acknowledged the last one. The twin doesn't read its 64-byte
+	receive ring while it loads a paragraph, and only acknowledges it once it is
+	reading again, so this much can wait in the ring however long the load takes.
+	It hides that much of the load behind the send. */
+#define PIPE_LEAD 56
+
+/** State of the randomization pipeline. The ring slots are used in order: the
+	RNG fills the slot after the last one filled, and paragraphs are sent from the
+	oldest filled slot. The slot before that is the last one sent; it stays the nand
+	buffer, which other NAND operations use as scratch, so the RNG leaves it alone. */
+static struct {
+	uint8_t head;		// the oldest filled slot, sent next
+	uint8_t filled;		// filled slots waiting to be sent
+	bool filling;		// the RNG is filling the slot after them
+	uint8_t unacked;	// paragraphs sent that the twin hasn't acknowledged (0 or 1)
+	uint32_t crc[PLANE_COUNT];	// CRC-32 of the data sent for the block in each plane
+} pipe;
+
+/**
+ * Move the RNG stage along: retire a finished fill, and start the RNG on the next
+ * slot if one is free.
+ */
+static void pipe_service() {
+	if (pipe.filling && hwrng_bits_done()) {
+		pipe.filling = false;
+		pipe.filled++;
+	}
+	if (!pipe.filling && pipe.filled < BUFFER_RING_LEN - 1) {
+		hwrng_bits_start(buffers_get_ring((pipe.head + pipe.filled) % BUFFER_RING_LEN),PARA_SIZE);
+		pipe.filling = true;
+	}
+}
+
+/**
+ * Read the twin's acknowledgement of the oldest paragraph it hasn't acknowledged.
+ */
+static void pipe_collect_ack() {
+	uint8_t rsp;
+#ifdef NAND_STATS
+	uint16_t t;
+#endif
+	STAT_START(t);
+	rsp = uart_consume();
+	STAT_ADD(ack_usec,t);
+	if (rsp == UTOK_DATA_ACK) {
+		//usb_debug("OK RSP\n");
+	} else {
+		print_usb_str("BAD RSP\n");
+	}
+	pipe.unacked--;
+}
+
+/**
+ * Collect every outstanding acknowledgement, so the twin is idle and the UART is free
+ * for other requests.
+ */
+static void pipe_drain() {
+	while (!uart_send_complete()) {
+		pipe_service();
+	}
+	while (pipe.unacked > 0) {
+		pipe_collect_ack();
+	}
+}
+
+/**
+ * Send the next filled paragraph to the twin and load it into the local NAND.
+ * @param block the block index
+ * @param page the page number
+ * @param para the paragraph within the page (0-3)
+ * @param paired true if the block is programmed together with its plane partner
+ * @param sync true to wait for the twin's acknowledgement before going on, when it
+ * starts an erase on receiving the paragraph and can't take in the next one meanwhile
+ */
+static void otp_randomize_para(uint16_t block, uint8_t page, uint8_t para, bool paired, bool sync) {
+	uint8_t* buf;
+	uint16_t i;
+	uint8_t plane;
+#ifdef NAND_STATS
+	uint16_t run, t;
+	STAT_START(run);
+#endif
+	// wait for the RNG to fill the next slot
+	STAT_START(t);
+	while (pipe.filled == 0) {
+		pipe_service();
+	}
+	STAT_ADD(rng_usec,t);
+	// wait for the UART to finish the last paragraph
+	STAT_START(t);
+	while (!uart_send_complete()) {
+		pipe_service();
+	}
+	STAT_ADD(uart_usec,t);
+	buf = buffers_get_ring(pipe.head);
+	// begin uart send; only the lead goes out before the twin has loaded the last paragraph
+	uart_send_byte(UTOK_BEGIN_DATA);
+	uart_send_byte(block >> 8);
+	uart_send_byte(block & 0xff);
+	uart_send_byte(page);
+	uart_send_byte(para);
+	if (pipe.unacked > 0) {
+		uart_send_buffer(buf,PIPE_LEAD - 5);
+		pipe_collect_ack();
+		uart_send_buffer(buf + PIPE_LEAD - 5,PARA_SIZE - (PIPE_LEAD - 5));
+	} else {
+		uart_send_buffer(buf,PARA_SIZE);
+	}
+	buffers_select_ring(pipe.head);
+	pipe.head = (pipe.head + 1) % BUFFER_RING_LEN;
+	pipe.filled--;
+	pipe.unacked++;
+	// the RNG only fills the data; leave the rest of the spare area erased, and
+	// ensure that local page is not accidentally marked!
+	for (i = PARA_SIZE; i < PARA_SIZE+PARA_SPARE_SIZE; i++) {
+		buf[i] = 0xff;
+	}
+	// load into the local nand; each page programs while the next one loads
+	STAT_START(t);
+	if (paired) {
+		nand_cache_plane_para(block,page,para);
+	} else {
+		nand_cache_para(block,page,para);
+	}
+	STAT_ADD(nand_usec,t);
+	// the twin builds the same CRC as it receives (see otp_verify_block)
+	plane = block >= nand_geometry.plane_blocks;
+	if (page == 0 && para == 0) {
+		pipe.crc[plane] = CRC32_INIT;
+	}
+	pipe.crc[plane] = crc32_update(pipe.crc[plane],buf,PARA_SIZE);
+	if (sync) {
+		pipe_drain();
+	}
+#ifdef NAND_STATS
+	rnd_stats.paragraphs++;
+	STAT_ADD(run_usec,run);
+#endif
+}
+
+/**
+ * Compare the CRC-32 of the data sent for a freshly randomized block against the
+ * one the twin built as it received it, and mark the block as bad on both boards
+ * if they differ. With OTP_READBACK_VERIFY, both boards also read the block back
+ * and check it against their CRC.
+ * @param block the block index
+ */
+static void otp_verify_block(uint16_t block) {
+	uint8_t rsp;
+	uint32_t crc_remote;
+	bool needs_mark = false;
+	const uint32_t crc_local = crc32_finish(pipe.crc[block >= nand_geometry.plane_blocks]);
+	uart_send_byte(UTOK_REQ_CHKSM);
+	uart_send_byte(block >> 8);
+	uart_send_byte(block & 0xff);
+
+#ifdef OTP_READBACK_VERIFY
+	{
+		struct checksum_ret readback = nand_block_checksum(block);
+		if (!readback.ok || readback.crc != crc_local) {
+			print_usb_str("MM READBACK\n");
+			needs_mark = true;
+		}
+		if (readback.corrected != 0) {
+			print_usb_str("CORRECTED ");
+			print_usb_dec(readback.corrected);
+			print_usb_str(" BITS\n");
+		}
+	}
+#endif
+
+	rsp = uart_consume();
+	if (rsp == UTOK_RSP_CHKSM_BAD) {
+		print_usb_str("MM RSP CHKSM BAD\n");
+		needs_mark = true;
+	} else if (rsp == UTOK_RSP_CHKSM) {
+		uint8_t i;
+		crc_remote = 0;
+		for (i = 0; i < 4; i++) {
+			crc_remote = (crc_remote << 8) | uart_consume();
+		}
+		if (crc_local != crc_remote) {
+			needs_mark = true;
+			print_usb_str("MM ");
+			print_usb_dec(crc_local);
+			print_usb_str(" ");
+			print_usb_dec(crc_remote);
+			print_usb_str("\n");
+		}
+	} else {
+		print_usb_str("BAD CHKSM RSP\n");
+		needs_mark = true;
+	}
+	if (needs_mark) {
+		print_usb_str("MISMATCH ON ");
+		print_usb_dec(block);
+		print_usb_str("\n\r");
+
+		uart_send_byte(UTOK_MARK_BLOCK);
+		uart_send_byte(block >> 8);
+		uart_send_byte(block & 0xff);
+
+		otp_mark_block(block,BU_BAD_BLOCK);
+
+		if (uart_consume() != UTOK_MARK_ACK) {
+			print_usb_str("BAD MARK RSP\n");
+		}
+	}
+
+	print_usb_str("BLOCK ");
+	print_usb_dec(block);
+	print_usb_str("\n");
+}
+
+/**
+ * Checkpoint randomization on both boards.
+ * @param next the first step not yet completed
+ */
+static void otp_checkpoint_twins(uint16_t next) {
+	uart_send_byte(UTOK_CHECKPOINT);
+	uart_send_byte(next >> 8);
+	uart_send_byte(next & 0xff);
+	otp_checkpoint_randomize(next);
+	if (uart_consume() != UTOK_CHECKPOINT_ACK) {
+		print_usb_str("BAD CHECKPOINT RSP\n");
+	}
+}
+#endif
+
+/**
+ * Get how many randomization steps go between checkpoints.
+ */
+static uint16_t progress_stride() {
+	return (nand_geometry.plane_blocks > PROGRESS_CHECKPOINTS)?
+			nand_geometry.plane_blocks / PROGRESS_CHECKPOINTS:1;
+}
+
+/**
+ * Show how far randomization has got on the LEDs, a quarter of the steps per LED.
+ * @param block the step being randomized
+ */
+static void show_progress(uint16_t block) {
+	const uint16_t quarter = nand_geometry.plane_blocks >> 2;
+	leds_set_led(0,(block>0)?LED_FAST_0:LED_OFF);
+	leds_set_led(1,(block>quarter)?LED_FAST_0:LED_OFF);
+	leds_set_led(2,(block>2*quarter)?LED_FAST_0:LED_OFF);
+	leds_set_led(3,(block>3*quarter)?LED_FAST_0:LED_OFF);
+}
+
+#ifdef OTP_SPLIT_RANDOMIZE
+/** State of a split randomization. Each exchange uses the three ring slots: the
+	paragraph this board sends, the one the RNG fills for the next exchange, and
+	the one the twin's paragraph is received into. They rotate by one slot each
+	exchange. */
+static struct {
+	bool master;
+	uint8_t own;				// the slot of the paragraph this board sends next
+	uint32_t crc[PLANE_COUNT];	// CRC-32 of the data of the block being randomized in each plane
+} split;
+
+/**
+ * Load a ring slot into the NAND, and add it to the CRC of its block.
+ */
+static void split_load(uint8_t slot, uint16_t block, uint8_t page, uint8_t para, bool paired) {
+	uint8_t* buf = buffers_get_ring(slot);
+	const uint8_t plane = block >= nand_geometry.plane_blocks;
+	uint16_t i;
+#ifdef NAND_STATS
+	uint16_t t;
+#endif
+	// the RNG only fills the data; leave the rest of the spare area erased, and
+	// ensure that local page is not accidentally marked!
+	for (i = PARA_SIZE; i < PARA_SIZE+PARA_SPARE_SIZE; i++) {
+		buf[i] = 0xff;
+	}
+	buffers_select_ring(slot);
+	STAT_START(t);
+	if (paired) {
+		nand_cache_plane_para(block,page,para);
+	} else {
+		nand_cache_para(block,page,para);
+	}
+	STAT_ADD(nand_usec,t);
+	split.crc[plane] = crc32_update(split.crc[plane],buf,PARA_SIZE);
+}
+
+/**
+ * Take what has arrived of the twin's paragraph out of the receive ring.
+ * @param buf the buffer the paragraph goes to
+ * @param got the bytes of it taken so far, its token included
+ * @param all true to wait for the rest of it
+ * @return the bytes taken so far
+ */
+static uint16_t split_receive(uint8_t* buf, uint16_t got, bool all) {
+	while (got < PARA_SIZE + 1 && (all || uart_has_data())) {
+		const uint8_t b = uart_consume();
+		if (got == 0) {
+			if (b != UTOK_SPLIT_DATA) {
+				print_usb_str("BAD SPLIT DATA\n");
+			}
+		} else {
+			buf[got - 1] = b;
+		}
+		got++;
+	}
+	return got;
+}
+
+/**
+ * Tell the twin this board is reading its receive ring again, and wait until the
+ * twin is too. Neither board sends a paragraph before then, so none arrives while
+ * the other is loading or erasing and can't take it out of the ring.
+ */
+static void split_sync() {
+#ifdef NAND_STATS
+	uint16_t t;
+#endif
+	uart_send_byte(UTOK_SPLIT_READY);
+	STAT_START(t);
+	if (uart_consume() != UTOK_SPLIT_READY) {
+		print_usb_str("BAD SPLIT SYNC\n");
+	}
+	STAT_ADD(ack_usec,t);
+}
+
+/**
+ * Exchange one pair of paragraphs of a page with the twin: once both boards are
+ * ready, send the one this board generated while the twin's arrives, then load both
+ * into the NAND. The master generates paragraphs 0 and 1 of each page and the twin
+ * 2 and 3, so the first exchange of a page swaps 0 and 2 and the second 1 and 3.
+ * Both boards load them in the order they are exchanged, master's first: 0, 2, 1, 3.
+ * @param block the block index
+ * @param page the page number
+ * @param half 0 for the first exchange of the page, 1 for the second
+ * @param paired true if the block is programmed together with its plane partner
+ */
+static void split_exchange(uint16_t block, uint8_t page, uint8_t half, bool paired) {
+	const uint8_t own = split.own;
+	const uint8_t rx = (own + 2) % BUFFER_RING_LEN;
+	uint8_t* buf = buffers_get_ring(rx);
+	uint16_t got = 0;
+#ifdef NAND_STATS
+	uint16_t run, t;
+	STAT_START(run);
+#endif
+	split_sync();
+	// wait for the RNG to fill this board's paragraph, and start on the next one;
+	// the twin's paragraph may be arriving meanwhile
+	STAT_START(t);
+	while (!hwrng_bits_done()) {
+		got = split_receive(buf,got,false);
+	}
+	STAT_ADD(rng_usec,t);
+	hwrng_bits_start(buffers_get_ring((own + 1) % BUFFER_RING_LEN),PARA_SIZE);
+	uart_send_byte(UTOK_SPLIT_DATA);
+	uart_send_buffer(buffers_get_ring(own),PARA_SIZE);
+	// take the rest of the twin's paragraph out of the receive ring as it arrives;
+	// nothing is loaded until it is all in
+	STAT_START(t);
+	split_receive(buf,got,true);
+	while (!uart_send_complete()) {}
+	STAT_ADD(uart_usec,t);
+	if (split.master) {
+		split_load(own,block,page,half,paired);
+		split_load(rx,block,page,half + 2,paired);
+	} else {
+		split_load(rx,block,page,half,paired);
+		split_load(own,block,page,half + 2,paired);
+	}
+	split.own = (own + 1) % BUFFER_RING_LEN;
+#ifdef NAND_STATS
+	rnd_stats.paragraphs++;
+	STAT_ADD(run_usec,run);
+#endif
+}
+
+/**
+ * Swap the CRC-32 of a freshly randomized block with the twin, and mark the block
+ * as bad if they differ. Both boards get both CRCs, so they agree on the marks.
+ * With OTP_READBACK_VERIFY, each board reads the block back and they swap the CRCs
+ * of what their chips kept instead; those cover the paragraphs in page order, not
+ * the order they were exchanged in, so they can't be checked against the CRCs
+ * built while writing.
+ * @param block the block index
+ */
+static void split_verify(uint16_t block) {
+	uint32_t crc_local;
+	uint32_t crc_remote = 0;
+	bool ok = true;
+	uint8_t rsp;
+	uint8_t i;
+#ifdef OTP_READBACK_VERIFY
+	{
+		struct checksum_ret readback = nand_block_checksum(block);
+		crc_local = readback.crc;
+		ok = readback.ok;
+	}
+#else
+	crc_local = crc32_finish(split.crc[block >= nand_geometry.plane_blocks]);
+#endif
+	if (ok) {
+		uart_send_byte(UTOK_RSP_CHKSM);
+		uart_send_byte(crc_local >> 24);
+		uart_send_byte((crc_local >> 16) & 0xff);
+		uart_send_byte((crc_local >> 8) & 0xff);
+		uart_send_byte(crc_local & 0xff);
+	} else {
+		uart_send_byte(UTOK_RSP_CHKSM_BAD);
+	}
+	rsp = uart_consume();
+	if (rsp == UTOK_RSP_CHKSM) {
+		for (i = 0; i < 4; i++) {
+			crc_remote = (crc_remote << 8) | uart_consume();
+		}
+	}
+	if (!ok || rsp != UTOK_RSP_CHKSM || crc_remote != crc_local) {
+		print_usb_str("MISMATCH ON ");
+		print_usb_dec(block);
+		print_usb_str("\n");
+		otp_mark_block(block,BU_BAD_BLOCK);
+	}
+}
+
+bool otp_randomize_split(uint16_t first, bool master) {
+	uint16_t block;
+	const uint16_t stride = progress_stride();
+#ifdef NAND_STATS
+	uint8_t i;
+	for (i = 0; i < sizeof(rnd_stats); i++) ((uint8_t*)&rnd_stats)[i] = 0;
+#endif
+	split.master = master;
+	split.own = 0;
+	hwrng_bits_start(buffers_get_ring(0),PARA_SIZE);
 	otp_set_flag(FLAG_DATA_STARTED);
 
-	for (block = 1; block < BLOCK_COUNT; block++) {
+	for (block = first; block < nand_geometry.plane_blocks; block++) {
+		// block 0 is the header, so its partner goes alone
+		const bool paired = block != 0;
+		const uint16_t partner = otp_plane_partner(block);
 		uint8_t page;
-		//bool hwrngblock = false;
-		//bool uartblock = false;
 
-		nand_block_erase(block);
+		// the twin's paragraphs only arrive once it has heard this board is ready,
+		// so nothing is lost in the receive ring while the erase runs
+		if (paired) {
+			nand_submit_erase_planes(block);
+		} else {
+			nand_submit_erase(partner);
+		}
+		split.crc[0] = split.crc[1] = CRC32_INIT;
+		show_progress(block);
 		nand_wait_for_ready();
 
-		leds_set_led(0,(block>0)?LED_FAST_0:LED_OFF);
-		leds_set_led(1,(block>512)?LED_FAST_0:LED_OFF);
-		leds_set_led(2,(block>1024)?LED_FAST_0:LED_OFF);
-		leds_set_led(3,(block>1536)?LED_FAST_0:LED_OFF);
 		for (page = 0; page < PAGE_COUNT; page++) {
-			uint8_t para;
-			for (para = 0; para < 4; para++) {
-				// Wait for RNG to finish filling buffer
-				while (!hwrng_bits_done()) {
-					//hwrngblock = true;
-				}
-				// swap buffers
-				buffers_swap();
-				// restart rng
-				hwrng_bits_start(buffers_get_rng(),512);
-				// begin uart send
-				uart_send_byte(UTOK_BEGIN_DATA);
-				uart_send_byte(block >> 8);
-				uart_send_byte(block & 0xff);
-				uart_send_byte(page);
-				uart_send_byte(para);
-				uart_send_buffer(buffers_get_nand(),PARA_SIZE);
-				// ensure that local page is not accidentally marked!
-				buffers_get_nand()[PARA_SIZE+PARA_SPARE_SIZE-1] = 0xff;
-				// write to local nand
-				nand_save_para(block,page,para);
-				// wait for write completion
-				nand_wait_for_ready();
-				// wait for io confirmation
-				while (!uart_send_complete()) {
-					//uartblock = true;
-				}
-				{
-					uint8_t rsp;
-					rsp = uart_consume();
-					if (rsp == UTOK_DATA_ACK) {
-						//usb_debug("OK RSP\n");
-					} else {
-						print_usb_str("BAD RSP\n");
-					}
-				}
+			if (paired) {
+				split_exchange(block,page,0,true);
+				split_exchange(block,page,1,true);
 			}
+			split_exchange(partner,page,0,paired);
+			split_exchange(partner,page,1,paired);
 		}
-		//if (hwrngblock) usb_debug("RNGBLK ");
-		//if (uartblock) usb_debug("UARTBLK ");
-
-		{
-			// Checksum check
-			uint8_t rsp;
-			uint16_t checksum_remote;
-			bool needs_mark = false;
-			struct checksum_ret checksum_local;
-			uart_send_byte(UTOK_REQ_CHKSM);
-			uart_send_byte(block >> 8);
-			uart_send_byte(block & 0xff);
-
-			checksum_local = nand_block_checksum(block);
-
-			rsp = uart_consume();
-			if (rsp == UTOK_RSP_CHKSM_BAD) {
-				print_usb_str("MM RSP CHKSM BAD\n");
-				needs_mark = true;
-			} else if (rsp == UTOK_RSP_CHKSM) {
-				checksum_remote = uart_consume() << 8;
-				checksum_remote |= uart_consume() & 0xff;
-				if (checksum_local.checksum != checksum_remote) {
-					needs_mark = true;
-					print_usb_str("MM ");
-					print_usb_dec(checksum_local.checksum);
-					print_usb_str(" ");
-					print_usb_dec(checksum_remote);
-					print_usb_str("\n");
-				}
-			} else {
-				print_usb_str("BAD CHKSM RSP\n");
-				needs_mark = true;
-			}
-			if (needs_mark) {
-				print_usb_str("MISMATCH ON ");
-				print_usb_dec(block);
-				print_usb_str("\n\r");
+		nand_wait_for_ready();
 
-				uart_send_byte(UTOK_MARK_BLOCK);
-				uart_send_byte(block >> 8);
-				uart_send_byte(block & 0xff);
+		// the nand buffer is scratch for a read-back; use the slot the RNG isn't filling
+		buffers_select_ring((split.own + 2) % BUFFER_RING_LEN);
+		if (paired) {
+			split_verify(block);
+		}
+		split_verify(partner);
+		// both boards reach the same checkpoints
+		if (((block + 1) & (stride - 1)) == 0 && block + 1 < nand_geometry.plane_blocks) {
+			otp_checkpoint_randomize(block + 1);
+		}
+	}
+	// don't leave the RNG writing into a slot after the exchange is over
+	while (!hwrng_bits_done()) {}
+	buffers_select_ring(0);
+	leds_set_mode(LM_DUAL_PROG_DONE);
+	otp_set_flag(FLAG_DATA_FINISHED);
+	return true;
+}
+#endif
 
-				otp_mark_block(block,BU_BAD_BLOCK);
+/**
+ * Run complete randomization process. Can take up to four hours to complete.
+ * Blocks are randomized in plane pairs (see otp_plane_partner); each pair is
+ * erased and programmed together, then each block is verified on its own so
+ * that a failure only marks the block that failed.
+ *
+ * Both boards checkpoint their progress as they go, and a randomization that was
+ * interrupted picks up from the last checkpoint the two share. Blocks written
+ * after it are erased again as they come up.
+ */
+bool otp_randomize_boards() {
+#ifdef OTP_SPLIT_RANDOMIZE
+	const uint16_t first = otp_agree_resume();
+	uart_send_byte(UTOK_BEGIN_SPLIT);
+	uart_send_byte(first >> 8);
+	uart_send_byte(first & 0xff);
+	return otp_randomize_split(first,true);
+#else
+	uint16_t block;
+	const uint16_t stride = progress_stride();
+	const uint16_t first = otp_agree_resume();
+#ifdef NAND_STATS
+	uint8_t i;
+	for (i = 0; i < sizeof(rnd_stats); i++) ((uint8_t*)&rnd_stats)[i] = 0;
+#endif
+	pipe.head = pipe.filled = pipe.unacked = 0;
+	pipe.filling = false;
+	buffers_select_ring(BUFFER_RING_LEN - 1);
+	pipe_service();
+	otp_set_flag(FLAG_DATA_STARTED);
+
+	for (block = first; block < nand_geometry.plane_blocks; block++) {
+		// block 0 is the header, so its partner goes alone
+		const bool paired = block != 0;
+		const uint16_t partner = otp_plane_partner(block);
+		uint8_t page;
 
-				if (uart_consume() != UTOK_MARK_ACK) {
-					print_usb_str("BAD MARK RSP\n");
+		// the erase runs while the first paragraph is generated and sent;
+		// loading it into the nand waits for the chip
+		if (paired) {
+			nand_submit_erase_planes(block);
+		} else {
+			nand_submit_erase(partner);
+		}
+
+		show_progress(block);
+		for (page = 0; page < PAGE_COUNT; page++) {
+			uint8_t para;
+			// the twin erases on the first paragraph of the pair
+			if (paired) {
+				for (para = 0; para < 4; para++) {
+					otp_randomize_para(block,page,para,true,page == 0 && para == 0);
 				}
 			}
+			for (para = 0; para < 4; para++) {
+				otp_randomize_para(partner,page,para,paired,!paired && page == 0 && para == 0);
+			}
 		}
+		// wait for the last page of the block(s) to finish programming, and for
+		// the twin to catch up before asking for its checksums
+		nand_wait_for_ready();
+		pipe_drain();
 
-		print_usb_str("BLOCK ");
-		print_usb_dec(block);
-		print_usb_str("\n");
+		if (paired) {
+			otp_verify_block(block);
+		}
+		otp_verify_block(partner);
+		if (((block + 1) & (stride - 1)) == 0 && block + 1 < nand_geometry.plane_blocks) {
+			otp_checkpoint_twins(block + 1);
+		}
 	}
+	// don't leave the RNG writing into a slot after the pipeline is gone
+	while (pipe.filling && !hwrng_bits_done()) {}
+	buffers_select_ring(0);
 	leds_set_mode(LM_DUAL_PROG_DONE);
 	otp_set_flag(FLAG_DATA_FINISHED);
 	return true;
+#endif
 }
 
 void otp_set_flag(uint8_t flag) {
@@ -358,25 +1095,36 @@ void otp_set_flag(uint8_t flag) {
 	uint32_t flagaddr = nand_make_addr(0,FLAGS_PAGE,0);
 	nand_read_raw_page(flagaddr,(uint8_t*)&flags,sizeof(flags));
 	nand_wait_for_ready();
+	// a flag set again, by a resumed randomization, doesn't take another program
 	if (flag == FLAG_DATA_FINISHED) {
+		if (flags.random_data_written == 0x00) return;
 		flags.random_data_written = 0x00;
 	} else if (flag == FLAG_DATA_STARTED) {
+		if (flags.random_data_started == 0x00) return;
 		flags.random_data_started = 0x00;
 	} else if (flag == FLAG_HEADER_WRITTEN) {
+		if (flags.header_written == 0x00) return;
 		flags.header_written = 0x00;
 	}
 	nand_program_raw_page(flagaddr,(uint8_t*)&flags,sizeof(flags));
 	nand_wait_for_ready();
+	if (flag == FLAG_DATA_FINISHED) {
+		metadata.config.randomization_finished = true;
+	} else if (flag == FLAG_DATA_STARTED) {
+		metadata.config.randomization_started = true;
+	}
 }
 
 /**
  * Mark a block as completely used
  */
 void otp_mark_block(uint16_t block, uint8_t usage) {
-	uint32_t addr = nand_make_para_addr(0,BLOCK_USAGE_PAGE,0);
-	addr += block;
-	nand_program_raw_page(addr, &usage, 1);
+	if (block >= nand_geometry.block_count) return;
+	nand_program_raw_page(usage_addr(block), &usage, 1);
 	nand_wait_for_ready();
+	if (usage != BU_UNUSED_BLOCK) {
+		metadata.unused[block >> 3] &= ~(1 << (block & 7));
+	}
 }
 
 /**
@@ -385,18 +1133,26 @@ void otp_mark_block(uint16_t block, uint8_t usage) {
  * @param backwards search backwards from the last block
  */
 uint16_t otp_find_unmarked_block(bool backwards) {
-	uint32_t addr = nand_make_para_addr(0,BLOCK_USAGE_PAGE,0);
-	uint8_t entry;
 	uint16_t i;
+	if (!metadata.loaded) otp_load_metadata();
+	// bytes of the bitmap with no unused blocks are skipped whole
 	if (!backwards) {
-		for (i = 1; i < BLOCK_COUNT; i++) {
-			nand_read_raw_page(addr+i,&entry,1);
-			if (entry == BU_UNUSED_BLOCK) { return i; }
+		for (i = 1; i < nand_geometry.block_count; i++) {
+			if (metadata.unused[i >> 3] == 0) {
+				i |= 7;
+			} else if (is_block_unused(i)) {
+				return i;
+			}
 		}
 	} else {
-		for (i = 2047; i > 0; i--) {
-			nand_read_raw_page(addr+i,&entry,1);
-			if (entry == BU_UNUSED_BLOCK) { return i; }
+		i = nand_geometry.block_count;
+		while (--i > 0) {
+			if (metadata.unused[i >> 3] == 0) {
+				i &= ~7;
+				if (i == 0) break;
+			} else if (is_block_unused(i)) {
+				return i;
+			}
 		}
 	}
 	return 0xffff;
@@ -415,6 +1171,61 @@ static bool is_page_available(uint16_t block, uint16_t page) {
 	return last_byte == 0xff;
 }
 
+/** Pages probed by the last page search. */
+static uint8_t page_probes;
+
+uint8_t otp_page_probes() {
+	return page_probes;
+}
+
+/**
+ * Find the first usable page of a block at or after a starting page, in the direction
+ * of the search.
+ *
+ * Provisioning consumes the pages of a block in order, so the used pages run from the
+ * start of the search up to the first available one, and the boundary is found with a
+ * binary search. The starting page is probed on its own first, since provisioning
+ * from the cursor usually finds it free. Pages retrieved out of order can break the
+ * ordering, as the twin's pages do at the far end of the block where the two halves
+ * meet; the search then may pass over free pages, but never returns a used one. So
+ * before the block is reported full, every page from the start is probed in turn.
+ * @param start the page to start from; one outside the block finds nothing
+ */
+static bool find_page_from(uint16_t block, int8_t start, uint16_t* page, bool backwards) {
+	// positions count pages in the direction of the search
+	uint8_t lo, hi;
+	page_probes = 0;
+	if (start < 0 || start >= PAGE_COUNT) return false;
+	lo = backwards?(PAGE_COUNT - 1 - start):start;
+	hi = PAGE_COUNT;
+	page_probes++;
+	if (is_page_available(block,start)) {
+		*page = start;
+		return true;
+	}
+	lo++;
+	// the first available position is in [lo, hi), or there is none if lo == PAGE_COUNT
+	while (lo < hi) {
+		const uint8_t mid = (lo + hi) / 2;
+		page_probes++;
+		if (is_page_available(block,backwards?(PAGE_COUNT - 1 - mid):mid)) {
+			hi = mid;
+		} else {
+			lo = mid + 1;
+		}
+	}
+	if (lo == PAGE_COUNT) {
+		// confirm the block is full
+		for (lo = (backwards?(PAGE_COUNT - 1 - start):start) + 1; lo < PAGE_COUNT; lo++) {
+			page_probes++;
+			if (is_page_available(block,backwards?(PAGE_COUNT - 1 - lo):lo)) break;
+		}
+		if (lo == PAGE_COUNT) return false;
+	}
+	*page = backwards?(PAGE_COUNT - 1 - lo):lo;
+	return true;
+}
+
 /**
  * Find the first/last usable page in the given block
  * @return true if a valid page is found
@@ -423,18 +1234,7 @@ static bool is_page_available(uint16_t block, uint16_t page) {
  * @param backwards search backwards from the last block
  */
 bool otp_find_unmarked_page(uint16_t block, uint16_t* page, bool backwards) {
-	uint8_t cpage;
-	for (cpage = 0; cpage < PAGE_COUNT; cpage++) {
-		if (backwards) {
-			*page = 63-cpage;
-		} else {
-			*page = cpage;
-		}
-		if (is_page_available(block,*page)) {
-				return true;
-		}
-	}
-	return false;
+	return find_page_from(block,backwards?(PAGE_COUNT-1):0,page,backwards);
 }
 
 /**
@@ -443,18 +1243,60 @@ bool otp_find_unmarked_page(uint16_t block, uint16_t* page, bool backwards) {
  * @return the usage status of the block (0xff if unused)
  */
 uint8_t otp_get_block_status(uint16_t block) {
-	uint32_t addr = nand_make_para_addr(0,BLOCK_USAGE_PAGE,0);
 	uint8_t entry;
-	nand_read_raw_page(addr+block,&entry,1);
+	if (!metadata.loaded) otp_load_metadata();
+	if (is_block_unused(block)) return BU_UNUSED_BLOCK;
+	// the bitmap doesn't tell used blocks from bad ones
+	nand_read_raw_page(usage_addr(block),&entry,1);
 	return entry;
 }
 
-static void otp_release_page(uint16_t block, uint16_t page) {
+#ifdef OTP_DEFERRED_ERASE
+/**
+ * Start erasing the consumed block, if there is one. The chip is busy until
+ * finish_pending_erase.
+ */
+static void submit_pending_erase() {
+	if (metadata.erase_pending != 0xffff) {
+		nand_submit_erase(metadata.erase_pending);
+	}
+}
+
+/**
+ * Wait for the erase of the consumed block and record it in the usage map.
+ */
+static void finish_pending_erase() {
+	if (metadata.erase_pending != 0xffff) {
+		nand_wait_for_ready();
+		otp_mark_block(metadata.erase_pending,BU_USED_BLOCK);
+		metadata.erase_pending = 0xffff;
+	}
+}
+#endif
+
+/**
+ * Emit a page over USB, once.
+ * @param block the block index
+ * @param page the page within the block
+ * @param zero true to zero the page on the chip; false to only mark it used
+ */
+static void otp_release_page(uint16_t block, uint16_t page, bool zero) {
 	uint8_t* buf;
-	const uint32_t full_page_num = (((uint32_t)block)*PAGE_COUNT)+page;
+	uint8_t* buf2;
+	uint8_t* half;
+	const uint32_t full_page_num = nand_page_number(block,page);
 	uint16_t i, para;
+	bool used;
+	if (!metadata.loaded) otp_load_metadata();
 	// check for previously released paragraph
-	bool used = !is_page_available(block,page);
+	used = !is_page_available(block,page);
+#ifdef OTP_DEFERRED_ERASE
+	// the pages of a consumed block may have been erased since
+	if (!used && !is_block_unused(block)) {
+		const uint8_t status = otp_get_block_status(block);
+		used = status == BU_CONSUMED_BLOCK || status == BU_USED_BLOCK;
+	}
+#endif
 	// display header
 	if (used) {
 		print_usb_str("---USED PAGE ");
@@ -465,41 +1307,107 @@ static void otp_release_page(uint16_t block, uint16_t page) {
 	print_usb_str("---\n");
 	if (used) { return; }
 	b64_print_init();
-	for (para = 0; para < 4; para++) {
-		// read para
-		nand_load_para(block,page,para);
-		// zero para on nand
-		nand_zero_paragraph(block,page,para);
-		// emit para in base64
-		buf = nand_para_buffer();
-		b64_print_buffer(buf,PARA_SIZE);
-		// null memory
+	// The whole page is read into RAM with one array read: the second half
+	// into the page half buffer, then the first half into the two paragraph
+	// buffers. It is then destroyed on the chip with a single program before
+	// any of it is emitted.
+	nand_load_page(block,page);
+	half = buffers_get_page_half();
+	for (para = 2; para < 4; para++) {
+		nand_page_para(para);
+		buf = buffers_get_nand();
 		for (i = 0; i < PARA_SIZE; i++) {
-			buf[i] = 0x00;
+			half[(para-2)*PARA_SIZE + i] = buf[i];
 		}
 	}
+	nand_page_para(0);
+	buffers_swap();
+	nand_page_para(1);
+	buf = buffers_get_rng();
+	buf2 = buffers_get_nand();
+	if (zero) {
+		nand_zero_page(nand_make_addr(block,page,0));
+	} else {
+		const uint8_t mark = 0x00;
+		nand_program_raw_page(nand_make_para_addr(block,page,0)+PARA_SIZE+PARA_SPARE_SIZE-1,&mark,1);
+		nand_wait_for_ready();
+	}
+#ifdef OTP_DEFERRED_ERASE
+	// the chip is done with the page, so the consumed block erases while
+	// the page is emitted
+	submit_pending_erase();
+#endif
+	// emit paras in base64
+	b64_print_buffer(buf,PARA_SIZE);
+	b64_print_buffer(buf2,PARA_SIZE);
+	b64_print_buffer(half,2*PARA_SIZE);
+	// null memory
+	for (i = 0; i < PARA_SIZE; i++) {
+		buf[i] = 0x00;
+		buf2[i] = 0x00;
+	}
+	for (i = 0; i < 2*PARA_SIZE; i++) {
+		half[i] = 0x00;
+	}
+	buffers_swap();
 	b64_print_finish();
+#ifdef OTP_DEFERRED_ERASE
+	finish_pending_erase();
+#endif
 	// display footer
 	print_usb_str("\n---END PAGE---\n");
 }
 
 bool otp_provision_one(bool is_A) {
 	uint16_t page_idx;
-	uint16_t block = otp_find_unmarked_block(!is_A);
-	if (!otp_find_unmarked_page(block,&page_idx,!is_A)) {
+	uint16_t block;
+	bool found;
+	if (!metadata.loaded) otp_load_metadata();
+	if (metadata.cursor_valid && is_block_unused(metadata.cursor.block)) {
+		// resume after the last page provisioned
+		block = metadata.cursor.block;
+		found = find_page_from(block,metadata.cursor.page + (is_A?1:-1),&page_idx,!is_A);
+	} else {
+		// no cursor since the journal filled, or none journaled: the usage map
+		// marks every block provisioning has left
+		block = otp_find_unmarked_block(!is_A);
+		if (block == 0xffff) return false;
+		found = otp_find_unmarked_page(block,&page_idx,!is_A);
+	}
+	if (!found) {
+#ifdef OTP_DEFERRED_ERASE
+		// only one block is left consumed at a time, so one still waiting
+		// from before a power loss is erased first
+		submit_pending_erase();
+		finish_pending_erase();
+		// erased while the next page is released
+		otp_mark_block(block,BU_CONSUMED_BLOCK);
+		metadata.erase_pending = block;
+#else
 		otp_mark_block(block,BU_USED_BLOCK);
+#endif
 		//print_usb_str("Marked block "); print_usb_dec(block); print_usb_str("; trying next\n");
 		block = otp_find_unmarked_block(!is_A);
+		if (block == 0xffff) return false;
 		if (!otp_find_unmarked_page(block,&page_idx,!is_A)) {
-			// TODO: report error, second empty block, probably exhausted!
+			// an unmarked block with every page used; it is left for the
+			// next call to mark
+			print_usb_str("No free page in unmarked block ");
+			print_usb_dec(block);
+			print_usb_str("\n");
 			return false;
 		}
 	}
-	otp_release_page(block,page_idx);
+#ifdef OTP_DEFERRED_ERASE
+	otp_release_page(block,page_idx,false);
+#else
+	otp_release_page(block,page_idx,true);
+#endif
+	advance_cursor(block,page_idx);
 	return true;
 }
 
-void otp_provision(uint8_t count,bool is_A) {
+void otp_provision(uint32_t count,bool is_A) {
 	while (count > 0) {
 		count--;
 		if (!otp_provision_one(is_A)) {
@@ -510,7 +1418,7 @@ void otp_provision(uint8_t count,bool is_A) {
 }
 
 void otp_retrieve(uint32_t page) {
-	const uint16_t block = page/PAGE_COUNT;
-	const uint16_t page_idx = page%PAGE_COUNT;
-	otp_release_page(block,page_idx);
+	const uint16_t block = nand_page_block(page);
+	const uint16_t page_idx = nand_page_index(page);
+	otp_release_page(block,page_idx,true);
 }
@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include "config.h"
 
 #define BBL_MAX_ENTRIES 16
 
@@ -49,7 +50,16 @@ typedef struct {
 } OTPConfig;
 
 /**
- * Read header information.
+ * Load the header, flags, bad block list and usage map from block 0 into RAM,
+ * and select the NAND ECC mode the pad was written with.
+ * This happens on the first call that needs them; the otp_* functions keep the
+ * copy up to date as they write block 0, so this only needs to be called again
+ * after block 0 has been changed some other way.
+ */
+void otp_load_metadata();
+
+/**
+ * Read header information, from the RAM copy of block 0 (see otp_load_metadata).
  * @return a populated OTPConfig with the state of the OTP NAND
  */
 OTPConfig otp_read_header();
@@ -69,14 +79,81 @@ bool otp_initialize_header(bool is_A);
 
 /**
  * Run complete randomization process. Can take up to four hours to complete.
+ *
+ * Paragraphs move through a pipeline of BUFFER_RING_LEN buffers: the RNG fills
+ * one while the last one filled is sent to the twin and loaded into the local
+ * NAND. The first bytes of the next paragraph are sent while the twin loads the
+ * last one, as many as its receive ring holds, and the rest once it has
+ * acknowledged it.
+ *
+ * An interrupted randomization resumes from the last checkpoint both boards
+ * have recorded (see otp_checkpoint_randomize).
  */
 bool otp_randomize_boards();
 
+#ifdef OTP_SPLIT_RANDOMIZE
+/**
+ * Randomize with both boards generating data (see OTP_SPLIT_RANDOMIZE). Each board
+ * generates half of every page and swaps it for the twin's other half, with data
+ * going both ways over the UART at once, and both program whole pages. Each pair
+ * is only sent once both boards are ready to take it in (UTOK_SPLIT_READY). The master
+ * calls this from otp_randomize_boards; the twin when told to begin.
+ * @param first the first step to randomize (see otp_checkpoint_randomize)
+ * @param master true on the board that generates the first half of each page
+ */
+bool otp_randomize_split(uint16_t first, bool master);
+#endif
+
+#ifdef NAND_STATS
+/**
+ * Time the last otp_randomize_boards spent stalled on each stage of its pipeline.
+ * The stage with the most stall time bounds the run.
+ */
+typedef struct {
+	uint32_t paragraphs;	// paragraphs sent to the twin
+	uint32_t run_usec;		// time spent sending paragraphs, stalls included
+	uint32_t rng_usec;		// waiting for the RNG to fill a paragraph
+	uint32_t uart_usec;		// waiting for the UART to finish sending the last paragraph (split: and the twin's to arrive)
+	uint32_t nand_usec;		// loading paragraphs into the local NAND, waits for the chip included
+	uint32_t ack_usec;		// waiting for the twin to acknowledge a paragraph (split: to be ready for the next exchange)
+} RandomizeStats;
+
+/**
+ * Get the pipeline stalls of the last randomization.
+ */
+const RandomizeStats* otp_get_randomize_stats();
+#endif
+
+/**
+ * Record in block 0 that randomization has completed every step before the given
+ * one. A step is a block of plane 0 and its partner (see otp_plane_partner).
+ * @param next the first step not yet completed
+ */
+void otp_checkpoint_randomize(uint16_t next);
+
+/**
+ * Get the step an interrupted randomization should resume from.
+ * @return the first step not checkpointed; 0 if none was, or if randomization
+ * has not started or has finished
+ */
+uint16_t otp_randomize_progress();
+
+/**
+ * Randomization works on pairs of blocks at the same offset in the two planes, which
+ * are erased and programmed together. Block 0 holds the header, so its partner is
+ * randomized alone, before any of the pairs; the last block of the chip is the last
+ * to be randomized.
+ * @param block a block index
+ * @return the block at the same offset in the other plane; 0 if the block is randomized alone
+ */
+uint16_t otp_plane_partner(uint16_t block);
+
 // The block usage page is a simple of map of the blocks of the chip; each block is represented by one byte. Block 0x00 is always marked as used.
 enum {
 	BU_UNUSED_BLOCK = 0xff,
 	BU_USED_BLOCK = 0x00,
-	BU_BAD_BLOCK = 0x70
+	BU_BAD_BLOCK = 0x70,
+	BU_CONSUMED_BLOCK = 0x0f	// used, but not yet erased (see OTP_DEFERRED_ERASE)
 };
 
 /**
@@ -101,6 +178,12 @@ uint16_t otp_find_unmarked_block(bool backwards);
  */
 bool otp_find_unmarked_page(uint16_t block, uint16_t* page, bool backwards);
 
+/**
+ * Debug function: get the number of pages probed by the last page search, in
+ * otp_find_unmarked_page or in provisioning.
+ */
+uint8_t otp_page_probes();
+
 /**
  * Debug function: check usage status of a block
  * @param the number of the block
@@ -109,11 +192,11 @@ bool otp_find_unmarked_page(uint16_t block, uint16_t* page, bool backwards);
 uint8_t otp_get_block_status(uint16_t block);
 
 /**
- * Provision a number of pages for use.
- * @param count The number of pages to provision, where 0 < count <= 4
+ * Provision a number of pages for use. The pages are emitted back to back.
+ * @param count The number of pages to provision
  * @param is_A True if is this the A board half; false if B.
  */
-void otp_provision(uint8_t count,bool is_A);
+void otp_provision(uint32_t count,bool is_A);
 
 /**
  * Retrieve a particular page for decoding.
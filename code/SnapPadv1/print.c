@@ -49,14 +49,18 @@ void print_usb_str(const char* s) {
 	cdcSendDataWaitTilDone((BYTE*) s, len, CDC0_INTFNUM, 100);
 }
 
-// Incremental base64 printer
+// Incremental base64 printer. The output is gathered into packets of up to
+// B64_PACKET bytes, the CDC endpoint size, since each send is a separate
+// USB transfer.
+#define B64_PACKET 64
 uint8_t in[3];
-uint8_t out[4];
+uint8_t out[B64_PACKET];
+uint8_t out_len;
 uint8_t line;
 uint8_t count;
 
 void b64_print_init() {
-	line = 0; count = 0;
+	line = 0; count = 0; out_len = 0;
 }
 
 void b64_print_buffer(uint8_t* buf, uint16_t sz) {
@@ -66,13 +70,18 @@ void b64_print_buffer(uint8_t* buf, uint16_t sz) {
 			sz--;
 		}
 		if (count == 3) {
-			encode(in,out,3);
-			cdcSendDataWaitTilDone((BYTE*) out, 4, CDC0_INTFNUM, 100);
+			encode(in,out+out_len,3);
+			out_len += 4;
 			line += 4;
 			if (line > 76) {
-				cdcSendDataWaitTilDone((BYTE*) "\n", 1, CDC0_INTFNUM, 100);
+				out[out_len++] = '\n';
 				line = 0;
 			}
+			// room for another four characters and a newline
+			if (out_len > B64_PACKET - 5) {
+				cdcSendDataWaitTilDone((BYTE*) out, out_len, CDC0_INTFNUM, 100);
+				out_len = 0;
+			}
 			count = 0;
 		}
 	}
@@ -83,8 +92,9 @@ void b64_print_finish() {
 		int l = count;
 		while (l < 3) { in[l++] = 0; }
 	}
-	encode(in,out,count);
-	cdcSendDataWaitTilDone((BYTE*) out, 4, CDC0_INTFNUM, 100);
+	encode(in,out+out_len,count);
+	out_len += 4;
+	cdcSendDataWaitTilDone((BYTE*) out, out_len, CDC0_INTFNUM, 100);
 }
 
 void print_usb_base64(uint8_t* buf, uint16_t sz) {
@@ -27,6 +27,16 @@ uint16_t timer_msec() {
 	return msecs;
 }
 
+uint16_t timer_usec() {
+	uint16_t ms, us;
+	// reread if the msec interrupt came in between the two
+	do {
+		ms = msecs;
+		us = TA1R;
+	} while (ms != msecs);
+	return (ms * 1000) + us;
+}
+
 #pragma vector=TIMER1_A0_VECTOR
 __interrupt void Timer1_A0 (void) {
 	msecs++;
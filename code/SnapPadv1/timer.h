@@ -16,5 +16,12 @@ void timer_reset();
 
 uint16_t timer_msec();
 
+/**
+ * Get a microsecond count that wraps every 65.536ms, for timing short
+ * intervals by subtraction. The count only advances past a millisecond
+ * while interrupts are enabled.
+ */
+uint16_t timer_usec();
+
 
 #endif /* TIMER_H_ */
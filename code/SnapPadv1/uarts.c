@@ -14,6 +14,7 @@
 #include <stdbool.h>
 #include "buffers.h"
 #include "nand.h"
+#include "crc32.h"
 #include "print.h"
 
 // Pins:
@@ -28,6 +29,9 @@ volatile uint8_t uart_rx_buf[UART_RING_LEN];
 volatile uint8_t* uart_tx_buf = 0;
 volatile uint16_t uart_tx_len = 0;
 
+/** CRC-32 of the data received so far for the block being randomized in each plane. */
+static uint32_t rx_crc[PLANE_COUNT];
+
 /**
  * Init the UART for cross-chip communication.
  */
@@ -218,14 +222,23 @@ void uart_process() {
 			uart_send_byte(has_confirm()?0xff:0x00);
 		} else if (command == UTOK_REQ_CHKSM) {
 			uint16_t block;
-			struct checksum_ret sum;
+			uint32_t crc;
+			bool ok = true;
 			block = uart_consume() << 8;
 			block |= uart_consume();
-			sum = nand_block_checksum(block);
-			if (sum.ok) {
+			crc = crc32_finish(rx_crc[block >= nand_geometry.plane_blocks]);
+#ifdef OTP_READBACK_VERIFY
+			{
+				struct checksum_ret sum = nand_block_checksum(block);
+				ok = sum.ok && sum.crc == crc;
+			}
+#endif
+			if (ok) {
 				uart_send_byte(UTOK_RSP_CHKSM);
-				uart_send_byte(sum.checksum >> 8);
-				uart_send_byte(sum.checksum & 0xff);
+				uart_send_byte(crc >> 24);
+				uart_send_byte((crc >> 16) & 0xff);
+				uart_send_byte((crc >> 8) & 0xff);
+				uart_send_byte(crc & 0xff);
 			} else {
 				uart_send_byte(UTOK_RSP_CHKSM_BAD);
 			}
@@ -235,43 +248,86 @@ void uart_process() {
 			block |= uart_consume();
 			otp_mark_block(block,BU_BAD_BLOCK);
 			uart_send_byte(UTOK_MARK_ACK);
+		} else if (command == UTOK_REQ_PROGRESS) {
+			const uint16_t next = otp_randomize_progress();
+			uart_send_byte(UTOK_RSP_PROGRESS);
+			uart_send_byte(next >> 8);
+			uart_send_byte(next & 0xff);
+		} else if (command == UTOK_CHECKPOINT) {
+			uint16_t next;
+			next = uart_consume() << 8;
+			next |= uart_consume();
+			otp_checkpoint_randomize(next);
+			uart_send_byte(UTOK_CHECKPOINT_ACK);
+#ifdef OTP_SPLIT_RANDOMIZE
+		} else if (command == UTOK_BEGIN_SPLIT) {
+			uint16_t first;
+			first = uart_consume() << 8;
+			first |= uart_consume();
+			otp_randomize_split(first,false);
+#endif
 		} else if (command == UTOK_BEGIN_DATA) {
 			uint16_t i;
 			uint8_t* buf;
 			// get the address
-			uint16_t block;
+			uint16_t block, partner;
 			uint8_t page;
 			uint8_t para;
+			uint8_t plane;
+			uint32_t crc;
 
 			block = uart_consume() << 8;
 			block |= uart_consume();
 			page = uart_consume();
 			para = uart_consume();
 
+			// build the CRC of the block's data as it arrives, for UTOK_REQ_CHKSM
+			plane = block >= nand_geometry.plane_blocks;
+			crc = (page == 0 && para == 0)?CRC32_INIT:rx_crc[plane];
 			buf = buffers_get_nand();
 			for (i = 0; i < PARA_SIZE; i++) {
 				buf[i] = uart_consume();
+				crc = crc32_byte(crc,buf[i]);
 			}
+			rx_crc[plane] = crc;
 
+			// blocks arrive in plane pairs, plane 0 first, except for the
+			// partner of the header block (see otp_plane_partner)
+			partner = otp_plane_partner(block);
 			if (page == 0 && para == 0) {
+				uint16_t offset = block & (nand_geometry.plane_blocks - 1);
+				uint16_t eighth = nand_geometry.plane_blocks >> 3;
 				leds_set_mode(LM_OFF);
-				if (block > 256) { leds_set_led(3,LED_FAST_0); }
-				if (block > 512+256) { leds_set_led(2,LED_FAST_0); }
-				if (block > 1024+256) { leds_set_led(1,LED_FAST_0); }
-				if (block > 1536+256) { leds_set_led(0,LED_FAST_0); }
-				nand_block_erase(block);
-				nand_wait_for_ready();
+				if (offset > eighth) { leds_set_led(3,LED_FAST_0); }
+				if (offset > 3*eighth) { leds_set_led(2,LED_FAST_0); }
+				if (offset > 5*eighth) { leds_set_led(1,LED_FAST_0); }
+				if (offset > 7*eighth) { leds_set_led(0,LED_FAST_0); }
+				if (partner == 0) {
+					nand_block_erase(block);
+					nand_wait_for_ready();
+					// set before the first page starts loading into the chip
+					otp_set_flag(FLAG_DATA_STARTED);
+					nand_wait_for_ready();
+				} else if (block < nand_geometry.plane_blocks) {
+					// loading the first paragraph waits for the erase
+					nand_submit_erase_planes(block);
+				}
 			}
 			// ensure that local page is not accidentally marked!
 			buffers_get_nand()[PARA_SIZE+PARA_SPARE_SIZE-1] = 0xff;
-			nand_save_para(block,page,para);
-			nand_wait_for_ready();
+			// each page programs while the next one loads
+			if (partner == 0) {
+				nand_cache_para(block,page,para);
+			} else {
+				nand_cache_plane_para(block,page,para);
+			}
+			if (page == PAGE_COUNT-1 && para == 3) {
+				nand_wait_for_ready();
+			}
 			uart_send_byte(UTOK_DATA_ACK);
-			if (block == 2047 && page == 63 && para == 3) {
+			if (block == nand_geometry.block_count-1 && page == PAGE_COUNT-1 && para == 3) {
 				leds_set_mode(LM_DUAL_PROG_DONE);
 				otp_set_flag(FLAG_DATA_FINISHED);
-			} else if (block == 1 && page == 0 && para == 0) {
-				otp_set_flag(FLAG_DATA_STARTED);
 			}
 		}
 	}
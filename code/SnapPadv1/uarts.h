@@ -48,16 +48,29 @@ enum {
 
 	// Protocol for sending pages of data
 	UTOK_BEGIN_DATA       = 0x23, // followed by 32-bit address, then 512 bytes
-	UTOK_DATA_ACK         = 0x24, // data transfer successfully written
+	UTOK_DATA_ACK         = 0x24, // data transfer successfully written, and receiving again
 	UTOK_DATA_NAK         = 0x25, // data transfer failed
 
 	UTOK_REQ_CHKSM        = 0x26, // followed by 16-bit block number
-	UTOK_RSP_CHKSM        = 0x27, // followed by 16-bit checksum
+	UTOK_RSP_CHKSM        = 0x27, // followed by 32-bit CRC of the block's data as received
 	UTOK_RSP_CHKSM_BAD    = 0x28, // no followup; checksum is bad and block should be marked
 
 	UTOK_MARK_BLOCK       = 0x29, // followed by 16-bit block number
 	UTOK_MARK_ACK         = 0x2A, // block marked
 
+	// Protocol for resuming an interrupted randomization
+	UTOK_REQ_PROGRESS     = 0x2B, // no followup
+	UTOK_RSP_PROGRESS     = 0x2C, // followed by 16-bit first randomization step not checkpointed
+	UTOK_CHECKPOINT       = 0x2D, // followed by 16-bit first randomization step not yet completed
+	UTOK_CHECKPOINT_ACK   = 0x2E, // checkpoint recorded
+
+	// Protocol for split randomization (see OTP_SPLIT_RANDOMIZE); both boards send
+	// UTOK_SPLIT_READY, UTOK_SPLIT_DATA and, at the end of each step, UTOK_RSP_CHKSM
+	// or UTOK_RSP_CHKSM_BAD for each of its blocks
+	UTOK_BEGIN_SPLIT      = 0x32, // followed by 16-bit first randomization step
+	UTOK_SPLIT_READY      = 0x33, // reading the receive ring, ready for the next exchange
+	UTOK_SPLIT_DATA       = 0x34, // followed by 512 bytes
+
 	UTOK_LAST
 };
 
@@ -71,6 +84,9 @@ void uart_init();
 	until a byte of data is available. */
 uint8_t uart_consume();
 
+/** Check if there is received data waiting to be consumed. */
+bool uart_has_data();
+
 /** Attempt to retrieve one byte of data from the uart. If no data is available,
 	wait for data until the given timeout, specified in milliseconds, passes.
 	Data is returned in the one-character buffer. Returns true if data is valid,
@@ -0,0 +1,40 @@
+#!/usr/bin/python
+import serial
+import sys
+import argparse
+
+p = None
+#p = sys.stdout
+
+ORDER = ['reads', 'programs', 'partial_programs', 'erases', 'bytes_in', 'bytes_out',
+         'corrected_bits', 'ecc_failures', 'busy_waits', 'busy_usec']
+
+def snapshot(reset):
+    global p
+    c = 'Sr\n\r' if reset else 'S\n\r'
+    p.write(c)
+    p.flush()
+    stats = {}
+    while True:
+        l = p.readline().strip()
+        if l == 'END STATS':
+            return stats
+        parts = l.split()
+        if len(parts) == 2 and parts[1].isdigit():
+            stats[parts[0]] = int(parts[1])
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description='Snapshot the NAND operation counters of a debug build snap-pad')
+    parser.add_argument('-r', '--reset', action='store_true', help='zero the counters after reading them')
+    parser.add_argument('-P', '--port', default='/dev/ttyACM0')
+    args = parser.parse_args()
+    p = serial.Serial(args.port,115200)
+    p.flushInput()
+    p.flush()
+    stats = snapshot(args.reset)
+    for name in ORDER:
+        print "{0:16} {1}".format(name, stats.get(name, 0))
+    if stats.get('busy_waits', 0) > 0:
+        print "busy {0:.3f} seconds, {1} usec per wait".format(
+            stats['busy_usec'] / 1000000.0, stats['busy_usec'] / stats['busy_waits'])
@@ -1,5 +1,5 @@
 #!/usr/bin/python
-from snap_pad import SnapPad, list_snap_pads, PAGESIZE, EncryptedMessage
+from snap_pad import SnapPad, list_snap_pads, MAX_MESSAGE_SIZE, EncryptedMessage
 
 from cStringIO import StringIO
 import snap_pad
@@ -60,10 +60,13 @@ def get_output(args):
             mode = 'w'
         return open(args.output, mode)
 
-def get_input(args):
+# an encoded message is its pages and signatures in base64, plus framing
+MAX_ENCODED_SIZE = MAX_MESSAGE_SIZE * 2
+
+def get_input(args,limit):
     inf = sys.stdin
-    indata = inf.read((PAGESIZE*4)+1)
-    if len(indata) > (PAGESIZE*4 - 2):
+    indata = inf.read(limit+1)
+    if len(indata) > limit:
         raise MessageTooLargeError()
     if len(indata) == 0:
         raise NoDataError()
@@ -130,7 +133,7 @@ def diagnostics_handler(args):
 def encode_handler(args):
     sp = find_our_pad(args)
     out = get_output(args)
-    raw_input = get_input(args)
+    raw_input = get_input(args,MAX_MESSAGE_SIZE)
     msg = sp.encrypt_and_sign(raw_input)
     if args.encoding == 'bin':
         msg.write_binary(out)
@@ -144,7 +147,7 @@ def encode_handler(args):
 def decode_handler(args):
     sp = find_our_pad(args)
     out = get_output(args)
-    raw_input = get_input(args)
+    raw_input = get_input(args,MAX_ENCODED_SIZE)
     msg = parse_input(args,raw_input)
     data = sp.decrypt_and_verify(msg)
     out.write(data)
@@ -21,13 +21,24 @@ from hashlib import sha256
 #
 # D                       - diagnostics
 # #                       - produce 64 bytes of random data from the RNG
-# Rpage[,page,page,page]  - retrieve (and zero) specified pages up to a
-#                           maximum of 4 pages. will wait for user button
-#                           press before continuing.
+# Rpages[,pages...]       - retrieve (and zero) specified pages. each entry
+#                           is a page number or a range "first-last" running
+#                           up or down. will wait for user button press before
+#                           continuing, then stream the pages back to back.
 # Pcount                  - provision (and zero) count pages. snap-pad
-#                           chooses next available pages. maximum count is 4.
-#                           will wait for user button press before continuing.
+#                           chooses next available pages. will wait for user
+#                           button press before continuing, then stream the
+#                           pages back to back.
 #
+# Firmware before 1.3 takes at most 4 pages per command, and no ranges.
+#
+
+# longest command line the pad will buffer, including the newline
+MAX_COMMAND = 128
+# pages per command on firmware that can't stream
+LEGACY_MAX_PAGES = 4
+# largest message the 16-bit size field of a marshalled message can describe
+MAX_MESSAGE_SIZE = 0xffff
 
 # regexps for parsing preambles
 preamble_re = re.compile('^---(BEGIN|USED) PAGE ([0-9]+)---$')
@@ -49,6 +60,24 @@ class BadSignatureException(Exception):
 def pages_needed_for(data):
     return int(math.ceil(len(data)/float(PAGESIZE)))
 
+def encode_page_ranges(page_idxs):
+    '''Encode a list of page numbers as retrieve command entries, collapsing runs
+    of consecutive pages (in either direction) into "first-last" ranges.'''
+    entries = []
+    i = 0
+    while i < len(page_idxs):
+        j = i + 1
+        if j < len(page_idxs) and abs(page_idxs[j] - page_idxs[i]) == 1:
+            step = page_idxs[j] - page_idxs[i]
+            while j < len(page_idxs) and page_idxs[j] - page_idxs[j-1] == step:
+                j = j + 1
+        if j - i > 1:
+            entries.append('{0}-{1}'.format(page_idxs[i],page_idxs[j-1]))
+        else:
+            entries.append(str(page_idxs[i]))
+        i = j
+    return entries
+
 
 
 class Page:
@@ -192,29 +221,60 @@ class SnapPad:
             assert len(p.bits) == 2048
         return p
         
+    def can_stream(self):
+        "Return true if the pad takes page ranges and counts of any size"
+        return (self.major,self.minor) >= (1,3)
+
+    def __retrieve_commands(self,page_idxs):
+        'Split a retrieval into commands the pad will accept.'
+        if not self.can_stream():
+            for i in range(0,len(page_idxs),LEGACY_MAX_PAGES):
+                yield [str(x) for x in page_idxs[i:i+LEGACY_MAX_PAGES]]
+            return
+        entries = []
+        for entry in encode_page_ranges(page_idxs):
+            if entries and len("R"+",".join(entries+[entry])+"\n") > MAX_COMMAND:
+                yield entries
+                entries = []
+            entries.append(entry)
+        yield entries
+
     def retrieve_pages(self,page_idxs):
         "Retrieve and zero a specified set of pages"
-        assert len(page_idxs) > 0 and len(page_idxs) <= 4
+        assert len(page_idxs) > 0
         for page_idx in page_idxs:
             assert page_idx > 0 and page_idx < (2048*64)
-        command = "R"+",".join(map(str,page_idxs))+"\n"
-        self.sp.write(command)
-        return [self.__read_page() for _ in range(len(page_idxs))]
+        pages = []
+        for entries in self.__retrieve_commands(page_idxs):
+            command = "R"+",".join(entries)+"\n"
+            self.sp.write(command)
+            for entry in entries:
+                ends = [int(x) for x in entry.split('-')]
+                count = abs(ends[-1] - ends[0]) + 1
+                pages = pages + [self.__read_page() for _ in range(count)]
+        return pages
 
     def provision_pages(self,count):
         "Provision the given count of pages"
-        assert count > 0 and count <= 4
-        command = "P{0}\n".format(count)
-        self.sp.write(command)
-        pages = [self.__read_page() for _ in range(count)]
+        assert count > 0
+        if self.can_stream():
+            counts = [count]
+        else:
+            counts = [LEGACY_MAX_PAGES] * (count // LEGACY_MAX_PAGES)
+            if count % LEGACY_MAX_PAGES:
+                counts.append(count % LEGACY_MAX_PAGES)
+        pages = []
+        for c in counts:
+            command = "P{0}\n".format(c)
+            self.sp.write(command)
+            pages = pages + [self.__read_page() for _ in range(c)]
         # TODO: Handle timeouts, other failures
-        return pages 
+        return pages
 
 
     def encrypt_and_sign(self,raw_message):
         "Encrypt and sign plaintext and return an encrypted message"
         data = self.marshall(raw_message)
-        assert len(data) <= PAGESIZE*4
         page_count = pages_needed_for(data)
         pages = self.provision_pages(page_count)
         pages.reverse()
@@ -229,7 +289,6 @@ class SnapPad:
 
     def decrypt_and_verify(self,msg):
         "Decrypt and verify an encrypted message, and return a decrypted message object"
-        assert len(msg.blocks) <= 4
         page_numbers = [x[0] for x in msg.blocks]
         pages = { p.page_idx:p for p in self.retrieve_pages(page_numbers) }
         decrypted = b''
@@ -255,6 +314,7 @@ class SnapPad:
     def marshall(self,raw_message):
         '''Marshalls a message prior to encryption. This consists of prepending a 16-bit
         message size and then padding the message to the next block boundry.'''
+        assert len(raw_message) <= MAX_MESSAGE_SIZE
         data = pack('>H',len(raw_message)) + raw_message
         pad_to = pages_needed_for(data) * PAGESIZE
         while pad_to > len(data):
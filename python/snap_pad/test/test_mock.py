@@ -50,7 +50,7 @@ class MockTest(unittest.TestCase):
 
     def doProvisionTest(self,count):
         self.sp.write('P{0}\n'.format(count))
-        if count < 1 or count > 4:
+        if count < 1 or (count > 4 and not self.sp.can_stream()):
             # check for error msg
             self.assertErrorMsg("bad count")
         else:
@@ -62,6 +62,11 @@ class MockTest(unittest.TestCase):
         for i in range(0,6):
             self.doProvisionTest(i)
 
+    def testLegacyProvision(self):
+        self.sp = SnapPadHWMock(minor=1)
+        for i in range(0,6):
+            self.doProvisionTest(i)
+
     def doRetrievalTest(self,addresses):
         self.assertGreater(len(addresses),0)
         self.assertLessEqual(len(addresses),4)
@@ -77,5 +82,10 @@ class MockTest(unittest.TestCase):
     def testMultipleRetrieval(self):
         self.doRetrievalTest([64,65,66,67])
 
+    def testRangeRetrieval(self):
+        self.sp.write('R64-66,70-68\n')
+        for a in [64,65,66,70,69,68]:
+            self.assertEqual(self.parsePage(),a)
+
 
 
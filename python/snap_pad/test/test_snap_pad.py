@@ -2,7 +2,7 @@ import unittest
 import re
 from .test_snap_pad_mock import SnapPadHWMock, MAJOR, MINOR
 from snap_pad import SnapPad, PAGESIZE, BadSignatureException
-from snap_pad.snap_pad import Page
+from snap_pad.snap_pad import Page, encode_page_ranges, MAX_MESSAGE_SIZE
 import array
 import random
 import math
@@ -62,6 +62,29 @@ class SnapPadTest(unittest.TestCase):
     def testProvisionFour(self):
         self.doProvision(4)
 
+    def testRetrievalRanges(self):
+        self.doRetrieval([64,65,66,67,68,90,80,79,78,100])
+
+    def testRetrievalManyEntries(self):
+        # more entries than fit on one command line
+        self.doRetrieval(range(64,2000,2))
+
+    def testProvisionMany(self):
+        self.doProvision(40)
+
+    def testEncodePageRanges(self):
+        self.assertEqual(encode_page_ranges([64]),['64'])
+        self.assertEqual(encode_page_ranges([64,65,66,70,69,68,80,82]),['64-66','70-68','80','82'])
+        self.assertEqual(encode_page_ranges([64,65,64]),['64-65','64'])
+
+    def testLegacyChunking(self):
+        mock = SnapPadHWMock(minor=1)
+        sp = SnapPad(mock,'MOCK')
+        self.assertFalse(sp.can_stream())
+        self.assertEqual(len(sp.provision_pages(10)),10)
+        pages = sp.retrieve_pages([64,65,66,67,68,69])
+        self.assertEqual([p.page_idx for p in pages],[64,65,66,67,68,69])
+
     def makeRandPage(self):
         pageidx = random.randint(64,2048*64)
         page = Page(pageidx)
@@ -94,13 +117,12 @@ class SnapPadTest(unittest.TestCase):
             testmsg = self.makeTestMsg(msgsz)
             self.assertEqual( len(self.sp.encrypt_and_sign(testmsg).blocks), blocks)
             self.assertGreater(blocks,0)
-            self.assertLessEqual(blocks,4)
-        for testsz in [PAGESIZE-3,PAGESIZE-2,PAGESIZE-1,PAGESIZE*2+1,PAGESIZE*3-1,PAGESIZE*4-2]:
+        for testsz in [PAGESIZE-3,PAGESIZE-2,PAGESIZE-1,PAGESIZE*2+1,PAGESIZE*3-1,PAGESIZE*4-2,PAGESIZE*10]:
             teasSize(self,testsz)
 
     def testEncryptAndSignOversize(self):
         with self.assertRaises(AssertionError):
-            self.sp.encrypt_and_sign(self.makeTestMsg((PAGESIZE*4)+1))
+            self.sp.encrypt_and_sign(self.makeTestMsg(MAX_MESSAGE_SIZE+1))
 
     def testDecryptAndVerify(self):
         def tdavSize(self,msgsz):
@@ -111,7 +133,7 @@ class SnapPadTest(unittest.TestCase):
             self.assertEqual( len(dec), msgsz)
             self.assertEqual(dec,testmsg)
         tdavSize(self,100)
-        for testsz in [PAGESIZE-1,PAGESIZE,PAGESIZE+1,PAGESIZE*2+1,PAGESIZE*3+1,PAGESIZE*4-2]:
+        for testsz in [PAGESIZE-1,PAGESIZE,PAGESIZE+1,PAGESIZE*2+1,PAGESIZE*3+1,PAGESIZE*4-2,PAGESIZE*10]:
             tdavSize(self,testsz)
 
     def testCorruptedSig(self):
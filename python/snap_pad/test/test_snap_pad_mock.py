@@ -8,7 +8,7 @@ import base64
 sys.stderr.write("*** WARNING: You are importing a test module. This is not for production use!\n")
 
 MAJOR = 1
-MINOR = 1
+MINOR = 3
 VARIANT = 'M'
 
 class SnapPadHWMock(serial.FileLike):
@@ -60,18 +60,34 @@ class SnapPadHWMock(serial.FileLike):
         self.outbuf += msg
         self.outbuf += '\n'
 
+    def can_stream(self):
+        return (self.major,self.minor) >= (1,3)
+
     def do_provision(self,command):
         count = int(command[1:])
-        if count < 1 or count > 4:
+        if count < 1 or (count > 4 and not self.can_stream()):
             self.do_error('bad count')
             return
         for page in range(count):
             self.provision_one(page+64)
 
     def do_retrieve(self,command):
+        if len(command) > 127:
+            self.do_error('command too long')
+            return
         spec = command[1:].split(',')
-        for page in spec:
-            self.release_page(int(page))
+        if len(spec) > 4 and not self.can_stream():
+            self.do_error('too many pages')
+            return
+        for entry in spec:
+            ends = [int(x) for x in entry.split('-')]
+            if len(ends) > 1 and not self.can_stream():
+                self.do_error('bad page')
+                return
+            first, last = ends[0], ends[-1]
+            step = 1 if last >= first else -1
+            for page in range(first,last+step,step):
+                self.release_page(page)
 
     def do_rng(self):
         self.outbuf += bytearray([self.rng.randint(0,255) for x in range(64)])